@@ -0,0 +1,117 @@
+/* Per-key switch debounce for the AGI 286/12 keyboard matrix.
+ * Copyright (c) 2013 W. Owen Parry
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "debounce.h"
+
+// Every key has a 3 bit counter, stored "vertically": bit n of the counters
+// of a row's 8 keys lives in one byte, so a row is updated 8 keys at a time
+// and the whole matrix needs 4 bytes per row.
+typedef struct {
+	uint8_t state;		// debounced columns
+	uint8_t c0, c1, c2;	// counter bits 0, 1 and 2
+} row_state;
+
+static row_state rows[NUM_ROWS];
+
+#define LIMIT (DEBOUNCE_SAMPLES - 1)
+
+static void clear(row_state *r, uint8_t m)
+{
+	r->c0 &= ~m;
+	r->c1 &= ~m;
+	r->c2 &= ~m;
+}
+
+void debounce_reset(void)
+{
+	uint8_t i;
+
+	for (i=0; i<NUM_ROWS; i++) {
+		rows[i].state = 0;
+		clear(&rows[i], 0xFF);
+	}
+}
+
+uint8_t debounce_pending(uint8_t row)
+{
+	return rows[row].c0 | rows[row].c1 | rows[row].c2;
+}
+
+#ifdef DEBOUNCE_EAGER
+
+// Counters hold the samples left to ignore, and count down to 0.
+uint8_t debounce(uint8_t row, uint8_t raw)
+{
+	row_state *r = &rows[row];
+	uint8_t locked = debounce_pending(row);
+	uint8_t toggle = (raw ^ r->state) & ~locked;
+	uint8_t borrow0, borrow1;
+
+	// decrement the running counters
+	borrow0 = locked & ~r->c0;
+	borrow1 = borrow0 & ~r->c1;
+	r->c0 ^= locked;
+	r->c1 ^= borrow0;
+	r->c2 ^= borrow1;
+
+	// and start them for keys that change now
+	r->state ^= toggle;
+	if (LIMIT & 1) r->c0 |= toggle;
+	if (LIMIT & 2) r->c1 |= toggle;
+	if (LIMIT & 4) r->c2 |= toggle;
+	return r->state;
+}
+
+#else
+
+// columns whose counter equals LIMIT
+static uint8_t at_limit(const row_state *r)
+{
+	return ((LIMIT & 1) ? r->c0 : ~r->c0)
+	     & ((LIMIT & 2) ? r->c1 : ~r->c1)
+	     & ((LIMIT & 4) ? r->c2 : ~r->c2);
+}
+
+// Counters hold how many samples in a row have disagreed with the state.
+uint8_t debounce(uint8_t row, uint8_t raw)
+{
+	row_state *r = &rows[row];
+	uint8_t delta = raw ^ r->state;
+	uint8_t done, carry;
+
+	clear(r, ~delta);		// agreement starts the count again
+	done = delta & at_limit(r);	// this is the last sample needed
+	r->state ^= done;
+	clear(r, done);
+
+	// increment the others
+	delta &= ~done;
+	carry = r->c0 & delta;
+	r->c0 ^= delta;
+	delta = carry;
+	carry = r->c1 & delta;
+	r->c1 ^= delta;
+	r->c2 ^= carry;
+	return r->state;
+}
+
+#endif
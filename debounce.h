@@ -0,0 +1,29 @@
+#ifndef debounce_h__
+#define debounce_h__
+
+#include <stdint.h>
+#include "layout.h"
+
+// Select DEBOUNCE_EAGER or DEBOUNCE_DEFERRED from the Makefile.
+//   eager:    a change is reported on the first sample that shows it, then
+//             the key is ignored for DEBOUNCE_SAMPLES-1 more samples.
+//   deferred: a change is reported once DEBOUNCE_SAMPLES consecutive
+//             samples agree on it.
+// Either way a key changes state at most once per DEBOUNCE_SAMPLES (1-8).
+#if !defined(DEBOUNCE_EAGER) && !defined(DEBOUNCE_DEFERRED)
+#define DEBOUNCE_EAGER
+#endif
+#ifndef DEBOUNCE_SAMPLES
+#define DEBOUNCE_SAMPLES 5
+#endif
+#if DEBOUNCE_SAMPLES < 1 || DEBOUNCE_SAMPLES > 8
+#error "DEBOUNCE_SAMPLES must be 1 to 8"
+#endif
+
+void debounce_reset(void);
+// Feed one sample of a row's columns (1 = closed), get the debounced ones.
+uint8_t debounce(uint8_t row, uint8_t raw);
+// Columns of a row whose counters are still running.
+uint8_t debounce_pending(uint8_t row);
+
+#endif
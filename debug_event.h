@@ -0,0 +1,35 @@
+#ifndef debug_event_h__
+#define debug_event_h__
+
+// Binary events on the debug channel.  Each is EVENT_BYTES bytes with the
+// top bit set, so they mix freely with text and the zero padding of
+// partly filled packets:
+//   1111tttt  type
+//   10rrrrrr  row
+//   10000ccc  column
+//   10ffffff  USB frame number, bits 0-5
+//   100fffff  USB frame number, bits 6-10
+// Only the first byte can read 1111xxxx, so a decoder that starts or
+// loses its place mid-event finds the next one.  tools/debug_decode turns
+// them back into text, with the key names.
+
+#define EVENT_KEYDOWN	0
+#define EVENT_KEYUP	1
+
+#define EVENT_BYTES	5
+#define EVENT_START	0xF0
+
+#define EVENT_PAYLOAD(x)		(0x80 | ((x) & 0x3F))
+#define EVENT_HEADER(type)		(EVENT_START | (type))
+#define EVENT_ROW_BYTE(row)		EVENT_PAYLOAD(row)
+#define EVENT_COL_BYTE(col)		EVENT_PAYLOAD(col)
+#define EVENT_FRAME_LO(frame)		EVENT_PAYLOAD(frame)
+#define EVENT_FRAME_HI(frame)		EVENT_PAYLOAD((frame) >> 6)
+
+#define EVENT_IS_HEADER(b)	(((b) & 0xF0) == EVENT_START)
+#define EVENT_TYPE(e)		((e)[0] & 0x0F)
+#define EVENT_ROW(e)		((e)[1] & 0x3F)
+#define EVENT_COL(e)		((e)[2] & 0x07)
+#define EVENT_FRAME(e)		(((e)[3] & 0x3F) | (((e)[4] & 0x1F) << 6))
+
+#endif
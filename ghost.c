@@ -0,0 +1,66 @@
+/* Ghost key detection for the AGI 286/12 keyboard matrix.
+ * Copyright (c) 2013 W. Owen Parry
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "ghost.h"
+
+// The matrix has no diodes, so when three closed switches sit on three
+// corners of a rectangle, current flows around it and the switch on the
+// fourth corner reads closed too, pressed or not.  Any corner of a
+// rectangle that reads closed all round could be that ghost.  Positions
+// with no switch can only ever be the ghost, so they are left out, and
+// only the rows that share two switch columns with a row can close a
+// rectangle with it.
+
+static const uint8_t key_mask[NUM_ROWS] = KEY_MASKS;	// layout_matrix.h
+static const uint16_t partners[NUM_ROWS] = GHOST_PARTNERS;
+
+// A ghost reads closed from the pass its rectangle closes, and eager
+// debouncing may hold that reading after the rectangle breaks again.  So a
+// key seen as a possible ghost stays one while its debouncing runs.
+static uint8_t suspect[NUM_ROWS];
+
+void ghost_filter(const uint8_t *cols, const uint8_t *pending, uint8_t *keys)
+{
+	uint8_t closed[NUM_ROWS];
+	uint8_t i, j, shared, ghosts;
+	uint16_t rows;
+
+	for (i=0; i<NUM_ROWS; i++) {
+		closed[i] = cols[i] & key_mask[i];
+	}
+	for (i=0; i<NUM_ROWS; i++) {
+		ghosts = 0;
+		// a rectangle needs two closed switches on this row
+		if (closed[i] & (closed[i] - 1)) {
+			for (j=0, rows=partners[i]; rows; j++, rows >>= 1) {
+				if (!(rows & 1)) continue;
+				shared = closed[i] & closed[j];
+				// and the same two on another
+				if (shared & (shared - 1)) ghosts |= shared;
+			}
+		}
+		suspect[i] = closed[i] & (ghosts | (suspect[i] & pending[i]));
+		// held keys stay until they open; new ones need to be unambiguous
+		keys[i] = closed[i] & (keys[i] | ~suspect[i]);
+	}
+}
@@ -0,0 +1,13 @@
+#ifndef ghost_h__
+#define ghost_h__
+
+#include <stdint.h>
+#include "layout.h"
+
+// Given a full pass of column readings and the columns still debouncing,
+// update keys (the switches reported as closed, one byte of columns per
+// row): keys that opened are dropped, keys that closed are added unless
+// they could be a ghost.
+void ghost_filter(const uint8_t *cols, const uint8_t *pending, uint8_t *keys);
+
+#endif
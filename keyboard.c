@@ -22,145 +22,83 @@
 
 #include <avr/io.h>
 #include <avr/pgmspace.h>
+#include <avr/interrupt.h>
+#include <string.h>
 #include <util/delay.h>
 #include "usb_keyboard_debug.h"
 #include "print.h"
+#include "layout.h"
+#include "matrix.h"
+#include "ghost.h"
+#include "latency.h"
+#include "profile.h"
+#include "keylog.h"
+#include "keymap.h"
+#include "keyname.h"
+#include "macro.h"
+#include "script.h"
+#include "debug_event.h"
 
 #define CPU_PRESCALE(n)	(CLKPR = 0x80, CLKPR = (n))
 
-#define NUM_COLUMNS 8
-#define NUM_MODIFIER_KEYS 4
-
-#define ROWS(oP)  \
-	oP(7) oP(6) oP(5) oP(4) oP(3) oP(2) oP(1) oP(0) oP(15) oP(14) oP(13) oP(12) oP(11)
-#define INDICES(row) row,
-#define ZERO(row) 0,
-#define NUM(row) 1 +
-#define NUM_ROWS (ROWS(NUM) 0)
-
 #define BIT(iNDEX) (1<<(iNDEX))
 #define BIT_IS_SET(rEG, iNDEX) ((rEG) & BIT(iNDEX))
 #define BIT_IS_CLEAR(rEG, iNDEX) (! BIT_IS_SET(rEG, iNDEX))
 
-#define KEY_NONE 0
-#define KEY_SYS_REQ KEY_PAUSE
-
-#define MAX_NAME_LENGTH 16
-
-#define KEYS(oP) \
-	{oP(F8),			oP(F7),		oP(F6),		oP(HOME),	oP(SCROLL_LOCK),	oP(NUM_LOCK),	oP(F10),	oP(F9)}, \
-	{oP(CAPS_LOCK),		oP(SPACE),	oP(NONE),	oP(F5), 	oP(F4), 			oP(F3),			oP(F2),		oP(F1)},\
-	{oP(9), 			oP(8),		oP(7),		oP(TAB),	oP(BACKSPACE),		oP(EQUAL),		oP(MINUS),	oP(0)},\
-	{oP(1), 			oP(ESC),	oP(NONE),	oP(6),		oP(5),				oP(4),			oP(3),		oP(2)},\
-	{oP(E), 			oP(W),		oP(Q),		oP(I),		oP(U),				oP(Y),			oP(T),		oP(R)},\
-	{oP(LEFT_BRACE),	oP(P),		oP(O),		oP(S),		oP(A),				oP(NONE),		oP(ENTER),	oP(RIGHT_BRACE)},\
-	{oP(NONE), 			oP(NONE),	oP(NONE),	oP(NONE),	oP(NONE),			oP(MOD_CTRL),	oP(NONE),	oP(NONE)},\
-	{oP(NONE), 			oP(NONE),	oP(MOD_ALT),oP(NONE),	oP(NONE),			oP(NONE),		oP(NONE),	oP(NONE)},\
-	{oP(G), 			oP(F),		oP(D),		oP(SEMICOLON),oP(L),			oP(K),			oP(J),		oP(H)},\
-	{oP(M), 			oP(N),		oP(B),		oP(SYS_REQ),oP(MOD_RIGHT_SHIFT),oP(SLASH),		oP(PERIOD),	oP(COMMA)},\
-	{oP(MOD_LEFT_SHIFT),oP(TILDE),	oP(QUOTE),	oP(V),		oP(C),				oP(X),			oP(Z),		oP(BACKSLASH)},\
-	{oP(PRINTSCREEN),	oP(PAGE_UP),oP(UP),		oP(END),	oP(NONE),			oP(RIGHT),		oP(NONE),	oP(LEFT)},\
-	{oP(INSERT), 		oP(PAGE_DOWN),oP(DOWN),	oP(NONE),	oP(NONE),			oP(NONE),		oP(NONE),	oP(DELETE)}
-#define CODE(k) KEY_##k
-#define NAME(k) #k
-
-#define KEY_MODIFIER_BIT 	(1<<7)
-#define KEY_MODIFIER_INDEX_MASK (KEY_MODIFIER_BIT - 1)
-#define KEY_MOD_LEFT_SHIFT  (KEY_MODIFIER_BIT | 0)
-#define KEY_MOD_RIGHT_SHIFT (KEY_MODIFIER_BIT | 1)
-#define KEY_MOD_CTRL 		(KEY_MODIFIER_BIT | 2)
-#define KEY_MOD_ALT 		(KEY_MODIFIER_BIT | 3)
-
-static char name_matrix[NUM_ROWS][NUM_COLUMNS][MAX_NAME_LENGTH] PROGMEM = { KEYS(NAME) };
-uint8_t code_matrix[NUM_ROWS][NUM_COLUMNS] = { KEYS(CODE) };
-uint8_t modifier_codes[NUM_MODIFIER_KEYS] = { KEY_LEFT_SHIFT, KEY_RIGHT_SHIFT, KEY_CTRL, KEY_ALT };
-
-// input columns are on pins D
-void init_columns(void)
-{
-	DDRD = 0x00; // configure as input (0)
-	PORTD = 0xFF; // configure as pull-up (1)
-	DDRB = 0x00;
-	PORTB = 0xFF;
-}
-
-uint8_t read_columns(void)
-{
-	uint8_t columns = ((~PIND) & 0xBF); // all columns except 6 are on D
-	columns |= (PINB & 1) ? 0x00 : 0x40; // column 6 is B0
-	return columns;
-}
-
-void select_row(uint8_t n)
-{
-	if (n < 8) {
-		DDRC |= (1<<n); 	// output
-		PORTC &= ~(1<<n); 	// low
-	} else {
-		n -= 8;
-		DDRF |= (1<<n);
-		PORTF &= ~(1<<n);
-	}
-	_delay_us(30);
-}
-
-void unselect_rows(void)
-{
-	// switch to high-impedence ie floating input
-	DDRC = 0x00;	//input
-	PORTC = 0x00;	// floating
-	DDRF &= 0x00; 	//input
-	PORTF &= 0x00; 	// floating
-	_delay_us(30);
-}
+uint8_t modifier_codes[NUM_MODIFIER_KEYS] = MODIFIER_CODES;
 
+#if DEBUG_LEVEL >= DEBUG_EVENTS && defined(DEBUG_FORMAT_TEXT)
 void print_row_col(uint8_t row, uint8_t col)
 {
-	print_P(name_matrix[row][col]);
+	print_P(keyname_at(row, col));
 	print(" ");
 	print("row:");
 	phex(row);
 	print(" col:");
 	phex(col);
 }
+#endif
 
-#define MAX_KEYS 6
-uint8_t num_keys_down = 0;
-void add_key(uint8_t code)
+// Trace a key change on the debug channel: as text, or as a 5 byte
+// binary event (see debug_event.h) that tools/debug_decode names.
+#if DEBUG_LEVEL >= DEBUG_EVENTS
+void print_key_event(uint8_t type, uint8_t row, uint8_t col)
 {
-	uint8_t i;
-	for (i=0; i<MAX_KEYS; i++) {
-		if (keyboard_keys[i] == 0) {
-			keyboard_keys[i] = code;
-			num_keys_down++;
-			break;
-		}
+#ifdef DEBUG_FORMAT_TEXT
+	if (type == EVENT_KEYDOWN) {
+		print("keydown ");
+	} else {
+		print("keyup   ");
 	}
+	print_row_col(row, col);
+	print("\n");
+#else
+	uint16_t frame = (UDFNUMH << 8) | UDFNUML;
+
+	pchar(EVENT_HEADER(type));
+	pchar(EVENT_ROW_BYTE(row));
+	pchar(EVENT_COL_BYTE(col));
+	pchar(EVENT_FRAME_LO(frame));
+	pchar(EVENT_FRAME_HI(frame));
+	usb_debug_flush_output();
+#endif
 }
+#else
+#define print_key_event(type, row, col)
+#endif
 
-void remove_key(uint8_t code)
+void add_key(uint8_t code)
 {
-	uint8_t i;
-	for (i=0; i<MAX_KEYS; i++) {
-		if (keyboard_keys[i] == code) {
-			keyboard_keys[i] = 0;
-			num_keys_down--;
-			break;
-		}
-	}
+	keyboard_keys[code >> 3] |= BIT(code & 7);
 }
 
-#define MAX_SEQUENCE_LENGTH 10
-#define NUM_SEQUENCES 10
-typedef struct {
-	uint8_t keyboard_modifier_keys;
-	uint8_t keyboard_keys[MAX_KEYS]; 
-} keys_state;
+void remove_key(uint8_t code)
+{
+	keyboard_keys[code >> 3] &= ~BIT(code & 7);
+}
 
-keys_state key_sequence[NUM_SEQUENCES][MAX_SEQUENCE_LENGTH];
-uint8_t sequence_length[NUM_SEQUENCES];
-uint8_t active_sequence;
 uint8_t program = 0;
+
 uint8_t handle_program(uint8_t code)
 {
 	if ( program ) {
@@ -174,8 +112,12 @@ uint8_t handle_program(uint8_t code)
 			case KEY_7:
 			case KEY_8:
 			case KEY_9:
-				active_sequence = code - KEY_1 + 1;
-				sequence_length[active_sequence] = 0;
+				macro_record(code - KEY_1);
+#if DEBUG_LEVEL >= DEBUG_VERBOSE
+				print("program: recording ");
+				pdec(code - KEY_1 + 1);
+				print("\n");
+#endif
 				return 1;
 			default:
 				program = 0;
@@ -185,70 +127,405 @@ uint8_t handle_program(uint8_t code)
 	return 0;
 }
 
-/* Log mode. Saves all sequences sent to PC to buffer for later repeat */
-#define MAX_LOG_LENGTH 100
-struct { uint8_t keyboard_modifier_keys; uint8_t keyboard_keys[MAX_KEYS]; } keyboard_log[MAX_LOG_LENGTH];
-uint8_t num_logged;
+/* Log mode. Saves the latest reports sent to PC (see keylog.h) for later
+ * repeat */
 
 void save_state(keys_state * pks)
 {
 	uint8_t i;
-	for(i=0;i<MAX_KEYS;i++) {
+	for(i=0;i<KEYBOARD_KEYS_SIZE;i++) {
 		pks->keyboard_keys[i] = keyboard_keys[i];
 	}
 	pks->keyboard_modifier_keys = keyboard_modifier_keys;
 }
-void play_state(keys_state *pks)
+// Send a replayed report, leaving keyboard_keys and the latency stamp to
+// the keys actually held
+void play_state(const keys_state *pks)
 {
+	keys_state held;
 	uint8_t j;
-	for (j=0; j<MAX_KEYS; j++) {
+#if LATENCY_STATS
+	uint16_t stamp = keyboard_report_stamp;
+
+	keyboard_report_stamp = 0;
+#endif
+	save_state(&held);
+	for (j=0; j<KEYBOARD_KEYS_SIZE; j++) {
 		keyboard_keys[j] = pks->keyboard_keys[j];
 	}
 	keyboard_modifier_keys = pks->keyboard_modifier_keys;
 	usb_keyboard_send();
+	for (j=0; j<KEYBOARD_KEYS_SIZE; j++) {
+		keyboard_keys[j] = held.keyboard_keys[j];
+	}
+	keyboard_modifier_keys = held.keyboard_modifier_keys;
+#if LATENCY_STATS
+	keyboard_report_stamp = stamp;
+#endif
 }
 
 void log(void)
 {
-	if (num_logged < MAX_LOG_LENGTH) {
-		save_state(&keyboard_log[num_logged++]);
-	}
-	if (active_sequence && sequence_length[active_sequence] < MAX_SEQUENCE_LENGTH) {
-		save_state(&key_sequence[active_sequence][sequence_length[active_sequence]++]);
+	keys_state now;
+
+	save_state(&now);
+	keylog_add(&now);
+	if (!macro_add(&now)) {
+		// keep what fitted, and say so
+		print("program: sequence ");
+		pdec(macro_recording + 1);
+		print(" full\n");
+		macro_stop();
 	}
 }
 
-void dump_log(void)
+/* Replay of the log (SysReq+D), or a sequence or script (SysReq+1-9).  The
+ * main loop steps it once per pass, sending a report once the last one has
+ * gone and REPLAY_FRAMES (and any delay the script asks for) have passed,
+ * so the matrix is scanned throughout.
+ * Keys found meanwhile are reported, and logged, when it ends; pressing
+ * SysReq ends it early. */
+
+#ifndef REPLAY_FRAMES
+#define REPLAY_FRAMES 1		// frames from one replayed report to the next
+#endif
+
+// How a sequence's recorded timing is kept, SysReq+F choosing the next:
+// not at all, a report every REPLAY_FRAMES; as recorded; or scaled to
+// REPLAY_SCALE percent of it.  A script's delays are always kept.
+#define TIMING_FAST 0
+#define TIMING_RECORDED 1
+#define TIMING_SCALED 2
+#ifndef REPLAY_SCALE
+#define REPLAY_SCALE 50
+#endif
+uint8_t replay_timing = TIMING_FAST;
+
+#define REPLAY_NONE 0
+#define REPLAY_LOG 1
+#define REPLAY_SEQUENCE 2
+#define REPLAY_SCRIPT 3
+
+// where a replay has got to in its source
+struct replay_pos {
+	union {
+		struct keylog_cursor log;	// REPLAY_LOG
+		struct macro_cursor sequence;	// REPLAY_SEQUENCE
+		struct script_cursor script;	// REPLAY_SCRIPT
+	};
+	uint16_t delay;		// extra frames to wait after the report read
+};
+
+uint8_t replaying = REPLAY_NONE;
+struct replay_pos replay_at;
+keys_state replay_sent;		// the last state sent to the host
+keys_state replay_base;		// sent next, before reading on, if
+uint8_t replay_release;		// this is set
+uint16_t replay_wait;		// frames to wait before the next report
+uint8_t replay_frame;		// UDFNUML when it was last counted down
+uint8_t report_pending = 0;
+
+uint8_t any_held(const keys_state *pks)
 {
 	uint8_t i;
-	for (i=0; i<num_logged; i++) {
-		play_state(&keyboard_log[i]);
+
+	if (pks->keyboard_modifier_keys) return 1;
+	for (i=0; i<KEYBOARD_KEYS_SIZE; i++) {
+		if (pks->keyboard_keys[i]) return 1;
 	}
+	return 0;
 }
 
-void play_sequence(uint8_t n)
+void replay_start(uint8_t source, uint8_t n)
 {
 	uint8_t i;
-	for (i=0; i<sequence_length[n]; i++) {
-		play_state(&key_sequence[n][i]);
+
+	replaying = source;
+	if (source == REPLAY_LOG) {
+		keylog_start(&replay_at.log);
+		replay_at.delay = 0;
+	} else if (source == REPLAY_SEQUENCE) {
+		macro_start(n, &replay_at.sequence);
+		replay_at.delay = 0;
+	} else {
+		script_start(n, &replay_at.script);
+		replay_at.delay = replay_at.script.delay;
 	}
+	// keys the host already sees held would merge with the first report
+	save_state(&replay_sent);
+	replay_release = any_held(&replay_sent);
+	replay_base.keyboard_modifier_keys = 0;
+	for (i=0; i<KEYBOARD_KEYS_SIZE; i++) {
+		replay_base.keyboard_keys[i] = 0;
+	}
+	replay_wait = replay_release ? 0 : replay_at.delay;
+	replay_frame = UDFNUML;
+}
+
+// back to the keys actually held
+void replay_stop(void)
+{
+	replaying = REPLAY_NONE;
+	report_pending = 1;
+}
+
+// the extra frames to wait for a recorded gap
+uint16_t replay_gap(uint16_t frames)
+{
+	if (replay_timing == TIMING_FAST) return 0;
+	if (replay_timing == TIMING_SCALED) {
+		frames = (uint32_t)frames * REPLAY_SCALE / 100;
+	}
+	return frames > REPLAY_FRAMES ? frames - REPLAY_FRAMES : 0;
+}
+
+// the next state from the source, or 0 at its end
+uint8_t replay_read(struct replay_pos *pos, keys_state *pks)
+{
+	if (replaying == REPLAY_LOG) {
+		if (!keylog_next(&pos->log)) return 0;
+		*pks = pos->log.state;
+	} else if (replaying == REPLAY_SEQUENCE) {
+		if (!macro_next(&pos->sequence)) return 0;
+		*pks = pos->sequence.state;
+		pos->delay = replay_gap(pos->sequence.delay);
+	} else {
+		if (!script_next(&pos->script)) return 0;
+		*pks = pos->script.state;
+		pos->delay = pos->script.delay;
+	}
+	return 1;
+}
+
+#if REPLAY_PACK
+// the usage of the one key pressed going from one state to the other, or 0
+// if anything else changed
+uint8_t single_press(const keys_state *from, const keys_state *to)
+{
+	uint8_t i, diff, code = 0;
+
+	if (from->keyboard_modifier_keys != to->keyboard_modifier_keys) return 0;
+	for (i=0; i<KEYBOARD_KEYS_SIZE; i++) {
+		diff = from->keyboard_keys[i] ^ to->keyboard_keys[i];
+		if (!diff) continue;
+		if (code || (diff & (diff - 1)) || (diff & from->keyboard_keys[i])) {
+			return 0;
+		}
+		for (code = i*8; !(diff & 1); diff >>= 1) code++;
+	}
+	return code;
+}
+
+// Is the next state in the source the one given?
+uint8_t replay_reads(struct replay_pos *pos, const keys_state *pks)
+{
+	keys_state next;
+
+	return replay_read(pos, &next)
+		&& memcmp(&next, pks, sizeof(next)) == 0;
+}
+
+// Pack a run of taps, each a key pressed from the last state sent and
+// released back to it, into next: up to 6 keys go down together and are
+// released by the report after.  Each key's usage must be above the one
+// before, as hosts read the keys in a report in usage order; a repeated
+// key, a change of modifiers or a script's delay ends the run.
+void replay_pack(keys_state *next)
+{
+	struct replay_pos pos = replay_at;
+	keys_state press;
+	uint8_t code, last, count;
+
+	last = single_press(&replay_sent, next);
+	if (!last || replay_at.delay || !replay_reads(&pos, &replay_sent)) return;
+	for (count = 1; count < 6; count++) {
+		replay_at = pos;
+		if (pos.delay || !replay_read(&pos, &press)) break;
+		code = single_press(&replay_sent, &press);
+		if (code <= last || pos.delay || !replay_reads(&pos, &replay_sent)) {
+			break;
+		}
+		next->keyboard_keys[code >> 3] |= BIT(code & 7);
+		last = code;
+	}
+	if (count == 6) replay_at = pos;
+	replay_base = replay_sent;
+	replay_release = 1;
+}
+#endif
+
+void replay_step(void)
+{
+	keys_state next;
+
+	uint8_t frame = UDFNUML;
+
+	if (!replaying) return;
+	// stepped at least once a frame, so the count never wraps
+	if (replay_wait > (uint8_t)(frame - replay_frame)) {
+		replay_wait -= (uint8_t)(frame - replay_frame);
+		replay_frame = frame;
+		return;
+	}
+	replay_wait = 0;
+	replay_frame = frame;
+	if (keyboard_queue_depth) return;
+	if (replay_release) {
+		replay_release = 0;
+		next = replay_base;
+	} else if (replay_read(&replay_at, &next)) {
+#if REPLAY_PACK
+		replay_pack(&next);
+#endif
+	} else {
+		replay_stop();
+		return;
+	}
+	play_state(&next);
+	replay_sent = next;
+	replay_wait = REPLAY_FRAMES + (replay_release ? 0 : replay_at.delay);
 }
 
 void reset_log(void)
 {
-	num_logged = 0;
+	keys_state now;
+
+	if (replaying == REPLAY_LOG) replay_stop();
+	save_state(&now);
+	keylog_reset(&now);
+}
+
+#if DEBUG_LEVEL >= DEBUG_ERRORS
+// passes handed to detect_changes since the last scan report
+uint16_t passes_processed = 0;
+uint16_t passes_reported = 0;
+uint16_t probes_reported = 0;
+
+// the settle time of each row, and where it came from
+void print_scan_settle(void)
+{
+	uint8_t i;
+
+	print("scan: settle");
+	for (i=0; i<NUM_ROWS; i++) {
+		pchar(' ');
+		pdec(matrix_settle_us[i]);
+	}
+	if (matrix_settle_from == SETTLE_MEASURED) {
+		print(" us, measured\n");
+	} else if (matrix_settle_from == SETTLE_SAVED) {
+		print(" us, saved\n");
+	} else {
+		print(" us, not measured\n");
+	}
+}
+
+#if DEBUG_LEVEL >= DEBUG_VERBOSE
+void print_scan_rate(void)
+{
+	print_scan_settle();
+	print("scan: rows sampled over ");
+	pdec(matrix_pass_us);
+	print("us, ");
+	pdec(SCAN_PASS_HZ);
+	print(" passes/s");
+#if SCAN_LEAD_US
+	print(", ending ");
+	pdec(SCAN_LEAD_US);
+	print("us before SOF");
+#endif
+	print("\n");
+}
+#endif
+
+void print_scan_stats(void)
+{
+	uint16_t passes = matrix_passes - passes_reported;
+	uint16_t probes = matrix_probes - probes_reported;
+
+	passes_reported += passes;
+	probes_reported += probes;
+	print_scan_settle();
+	print("scan: processed ");
+	pdec(passes_processed);
+	print(" of ");
+	pdec(passes);
+	print(" passes, effective ");
+	pdec(passes ? (uint32_t)passes_processed * SCAN_PASS_HZ / passes : 0);
+	print(" Hz, ");
+	pdec(probes);
+	print(" idle probes\n");
+#if SCAN_LEAD_US
+	print("scan: last lead ");
+	pdec(matrix_sof_lead_us);
+	print("us, ");
+	pdec(matrix_sof_late);
+	print(" late\n");
+	matrix_sof_late = 0;
+#endif
+	print("usb: report queue max ");
+	pdec(keyboard_queue_max);
+	print(" of ");
+	pdec(KEYBOARD_QUEUE_SIZE);
+	print(", ");
+	pdec(keyboard_queue_overflows);
+	print(" merged\n");
+	keyboard_queue_max = 0;
+	keyboard_queue_overflows = 0;
+	print("debug: ");
+	pdec(debug_dropped);
+	print(" messages dropped\n");
+	debug_dropped = 0;
+	passes_processed = 0;
+}
+#endif
+
+// start-of-frame interrupt, once per millisecond while configured; a
+// replay, or a sequence being recorded or saved, goes on each frame even
+// while the matrix is idle
+void usb_start_of_frame(void)
+{
+	matrix_sof();
+	if (replaying || macro_writing || macro_recording != NO_SEQUENCE) {
+		matrix_wake();
+	}
 }
 
 uint8_t sys_req = 0;
 void handle_sys_req(uint8_t code)
 {
+	uint8_t n;
+
 	switch (code) {
+#if DEBUG_LEVEL >= DEBUG_ERRORS
+		case KEY_S:
+			print_scan_stats();
+			break;
+#endif
+#if LATENCY_STATS
+		case KEY_L:
+			latency_print();
+			break;
+#endif
+#if PROFILE
+		case KEY_T:
+			profile_print();
+			break;
+#endif
 		case KEY_D:
-			dump_log();
+			replay_start(REPLAY_LOG, 0);
 			break;
 		case KEY_R:
 			reset_log();
 			break;
+		case KEY_F:
+			replay_timing = (replay_timing + 1) % 3;
+#if DEBUG_LEVEL >= DEBUG_VERBOSE
+			if (replay_timing == TIMING_FAST) print("replay: fast\n");
+			else if (replay_timing == TIMING_RECORDED) print("replay: as recorded\n");
+			else print("replay: scaled\n");
+#endif
+			break;
 		case KEY_1:
 		case KEY_2:
 		case KEY_3:
@@ -258,7 +535,12 @@ void handle_sys_req(uint8_t code)
 		case KEY_7:
 		case KEY_8:
 		case KEY_9:
-			play_sequence(code - KEY_1 + 1);
+			n = code - KEY_1;
+			if (macro_empty(n) && script_defined(n)) {
+				replay_start(REPLAY_SCRIPT, n);
+			} else {
+				replay_start(REPLAY_SEQUENCE, n);
+			}
 			break;
 		case KEY_P:
 			program = 1;
@@ -267,6 +549,27 @@ void handle_sys_req(uint8_t code)
 	}
 }
 
+// Changes are applied as they are found, then reported and logged once
+// per pass (or per row, with REPORT_PER_ROW), so a chord reaches the host
+// in one report.  They wait while a replay runs.
+void send_report(void)
+{
+	if (!report_pending || replaying) return;
+	report_pending = 0;
+#if DEBUG_LEVEL >= DEBUG_ERRORS
+	uint16_t merged = keyboard_queue_overflows;
+#endif
+	PROFILE_START(sent);
+	usb_keyboard_send();
+	PROFILE_END(SEND, sent);
+#if DEBUG_LEVEL >= DEBUG_ERRORS
+	if (keyboard_queue_overflows != merged) print("usb: report queue full\n");
+#endif
+	PROFILE_START(logged);
+	log();
+	PROFILE_END(LOG, logged);
+}
+
 uint8_t detect_row;
 void set_detect_row(uint8_t row)
 {
@@ -275,10 +578,9 @@ void set_detect_row(uint8_t row)
 
 void on_keydown(uint8_t col)
 {
-	print("keydown ");
-	print_row_col(detect_row, col);
-	print("\n");
-	uint8_t code = code_matrix[detect_row][col];
+	print_key_event(EVENT_KEYDOWN, detect_row, col);
+	uint8_t code = keymap_press(detect_row, col);
+	if (code == KEY_NONE) return;	// a layer key
 	if ( handle_program(code) ) {
 		return;
 	} else if ( sys_req ) {
@@ -287,20 +589,20 @@ void on_keydown(uint8_t col)
 		keyboard_modifier_keys |= modifier_codes[code & KEY_MODIFIER_INDEX_MASK];
 	} else if ( code == KEY_SYS_REQ ) {
 		sys_req = 1;
-		active_sequence = 0;
+		macro_stop();
+		if (replaying) replay_stop();
 	} else {
 		add_key(code);
 	}
-	usb_keyboard_send();
-	log();
+	latency_found(detect_row);
+	report_pending = 1;
 }
 
 void on_keyup(uint8_t col)
 {
-	print("keyup   ");
-	print_row_col(detect_row, col);
-	print("\n");
-	uint8_t code = code_matrix[detect_row][col];
+	print_key_event(EVENT_KEYUP, detect_row, col);
+	uint8_t code = keymap_release(detect_row, col);
+	if (code == KEY_NONE) return;
 	if (code & KEY_MODIFIER_BIT) {
 		keyboard_modifier_keys &= ~ modifier_codes[code & KEY_MODIFIER_INDEX_MASK];
 	} else if ( code == KEY_SYS_REQ ) {
@@ -308,8 +610,8 @@ void on_keyup(uint8_t col)
 	} else {
 		remove_key(code);
 	}
-	usb_keyboard_send();
-	log();
+	latency_found(detect_row);
+	report_pending = 1;
 }
 
 void detect_changes(uint8_t cols, uint8_t prev_cols)
@@ -320,7 +622,6 @@ void detect_changes(uint8_t cols, uint8_t prev_cols)
 			on_keyup(i);
 		}
 	}
-	if (num_keys_down >= 2) return; /* anti-ghosting */
 	for (i=0; i< NUM_COLUMNS; i++) {
 		if (BIT_IS_SET(cols,i) && BIT_IS_CLEAR(prev_cols,i)) {
 			on_keydown(i);
@@ -334,8 +635,8 @@ int main(void)
 	CPU_PRESCALE(0);
 
 	// set columns for input and rows as off
-	init_columns();
-	unselect_rows();
+	matrix_init();
+	macro_load();
 
 	DDRD |= (1<<6); // led is output
 	PORTD &= ~(1<<6); // led is off
@@ -350,18 +651,53 @@ int main(void)
 	// and do whatever it does to actually be ready for input
 	_delay_ms(1000);
 
-	uint8_t indices[NUM_ROWS] 	= { ROWS(INDICES) }; 
-	uint8_t prev_cols[NUM_ROWS] = { ROWS(ZERO) };
+	uint8_t prev_cols[NUM_ROWS] = { 0 };
+	uint8_t cols[NUM_ROWS], pending[NUM_ROWS], keys[NUM_ROWS];
+
+	matrix_start();
+#if DEBUG_LEVEL >= DEBUG_VERBOSE
+	print_scan_rate();
+#endif
+#if DEBUG_LEVEL >= DEBUG_ERRORS
+	passes_reported = matrix_passes;
+	probes_reported = matrix_probes;
+#endif
 
 	uint8_t i;
 	while (1) {
+		if (!matrix_wait_pass()) {
+			replay_step();
+			send_report();
+			macro_poll();
+			continue;
+		}
+#if DEBUG_LEVEL >= DEBUG_ERRORS
+		passes_processed++;
+#endif
+		// one snapshot of the pass, before the scanner starts the next
+		cli();
+		for (i=0; i< NUM_ROWS; i++) {
+			cols[i] = matrix_cols[i];
+			pending[i] = matrix_pending[i];
+			latency_snapshot(i);
+		}
+		sei();
+		for (i=0; i< NUM_ROWS; i++) keys[i] = prev_cols[i];
+		PROFILE_START(ghost);
+		ghost_filter(cols, pending, keys);
+		PROFILE_END(GHOST, ghost);
+		PROFILE_START(detect);
 		for (i=0; i< NUM_ROWS; i++) {
-			select_row(indices[i]);
-			uint8_t cols = read_columns();
-			unselect_rows();
 			set_detect_row(i);
-			detect_changes(cols, prev_cols[i]);
-			prev_cols[i] = cols;
+			detect_changes(keys[i], prev_cols[i]);
+			prev_cols[i] = keys[i];
+#if REPORT_PER_ROW
+			send_report();
+#endif
 		}
+		PROFILE_END(DETECT, detect);
+		replay_step();
+		send_report();
+		macro_poll();
 	}
 }
\ No newline at end of file
@@ -0,0 +1,119 @@
+/* Compressed log of the reports sent by the AGI 286/12 keyboard.
+ * Copyright (c) 2013 W. Owen Parry
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "keylog.h"
+
+#if KEYLOG_SIZE < 256 || (KEYLOG_SIZE & (KEYLOG_SIZE - 1))
+#error "KEYLOG_SIZE must be a power of 2, from 256"
+#endif
+
+#define NEXT(i) (((i) + 1) & (KEYLOG_SIZE - 1))
+
+static uint8_t ring[KEYLOG_SIZE];
+static uint16_t head = 0, tail = 0;	// oldest byte, next free byte
+static keys_state base;	// before the oldest report kept
+static keys_state last;	// after the newest
+uint16_t keylog_count = 0;
+
+void keylog_flip(keys_state *s, uint8_t code)
+{
+	code &= ~KEYLOG_LAST_CHANGE;
+	if (!code) return;
+	if (code >= KEYLOG_MODIFIER_CODE(0)) {
+		s->keyboard_modifier_keys ^= 1 << (code - KEYLOG_MODIFIER_CODE(0));
+	} else {
+		s->keyboard_keys[code >> 3] ^= 1 << (code & 7);
+	}
+}
+
+// forget the oldest report, folding it into base
+static void drop_oldest(void)
+{
+	uint8_t code;
+
+	do {
+		code = ring[head];
+		keylog_flip(&base, code);
+		head = NEXT(head);
+	} while (!(code & KEYLOG_LAST_CHANGE));
+	keylog_count--;
+}
+
+// a report changes at most 127 keys, so the one being written is never
+// the oldest here
+static void push(uint8_t code)
+{
+	if (NEXT(tail) == head) drop_oldest();
+	ring[tail] = code;
+	tail = NEXT(tail);
+}
+
+static void push_changes(uint8_t changed, uint8_t first_code)
+{
+	uint8_t bit;
+
+	for (bit=0; changed; bit++, changed >>= 1) {
+		if (changed & 1) push(first_code + bit);
+	}
+}
+
+void keylog_reset(const keys_state *now)
+{
+	head = tail = 0;
+	keylog_count = 0;
+	base = last = *now;
+}
+
+void keylog_add(const keys_state *now)
+{
+	uint16_t start = tail;
+	uint8_t i;
+
+	push_changes(now->keyboard_modifier_keys ^ last.keyboard_modifier_keys,
+		KEYLOG_MODIFIER_CODE(0));
+	for (i=0; i<KEYBOARD_KEYS_SIZE; i++) {
+		push_changes(now->keyboard_keys[i] ^ last.keyboard_keys[i], i * 8);
+	}
+	if (tail == start) return;	// nothing changed
+	ring[(tail - 1) & (KEYLOG_SIZE - 1)] |= KEYLOG_LAST_CHANGE;
+	keylog_count++;
+	last = *now;
+}
+
+void keylog_start(struct keylog_cursor *c)
+{
+	c->pos = head;
+	c->state = base;
+}
+
+uint8_t keylog_next(struct keylog_cursor *c)
+{
+	uint8_t code;
+
+	if (c->pos == tail) return 0;
+	do {
+		code = ring[c->pos];
+		keylog_flip(&c->state, code);
+		c->pos = NEXT(c->pos);
+	} while (!(code & KEYLOG_LAST_CHANGE));
+	return 1;
+}
@@ -0,0 +1,45 @@
+#ifndef keylog_h__
+#define keylog_h__
+
+#include <stdint.h>
+#include "usb_keyboard_debug.h"
+
+// A keyboard report: the modifier byte and one bit per key usage.
+typedef struct {
+	uint8_t keyboard_modifier_keys;
+	uint8_t keyboard_keys[KEYBOARD_KEYS_SIZE];
+} keys_state;
+
+// The log keeps the reports sent to the host as the keys each one changed,
+// a byte per key, in a ring of KEYLOG_SIZE bytes that forgets the oldest
+// reports to make room.
+#ifndef KEYLOG_SIZE
+#define KEYLOG_SIZE 512	// a power of 2, from 256
+#endif
+
+extern uint16_t keylog_count;	// reports kept
+
+// Each byte of the log names a key whose state a report flipped: its
+// usage, or KEYLOG_MODIFIER_CODE() of a modifier bit, which fits in the 7
+// bits as usages stop at 119.  KEYLOG_LAST_CHANGE marks the last key of a
+// report.  Code 0 (no key) flips nothing, and is kept back for anything
+// else a log might carry.
+#define KEYLOG_LAST_CHANGE 0x80
+#define KEYLOG_MODIFIER_CODE(bit) (KEYBOARD_MAX_USAGE + 1 + (bit))
+void keylog_flip(keys_state *s, uint8_t code);
+
+// forget every report; the next one is logged against this state
+void keylog_reset(const keys_state *now);
+// log a report, if it changed anything
+void keylog_add(const keys_state *now);
+
+// Replay: keylog_start() then keylog_next() gives each report kept, oldest
+// first, in state, until it returns 0.  Nothing may be logged meanwhile.
+struct keylog_cursor {
+	uint16_t pos;
+	keys_state state;
+};
+void keylog_start(struct keylog_cursor *c);
+uint8_t keylog_next(struct keylog_cursor *c);
+
+#endif
@@ -0,0 +1,127 @@
+/* Keymap layers for the AGI 286/12 keyboard.
+ * Copyright (c) 2013 W. Owen Parry
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <avr/pgmspace.h>
+#include "keymap.h"
+
+#if NUM_LAYERS > 4
+#error "pressed_on keeps 2 bits of layer"
+#endif
+
+#define ____ KEY_TRANSPARENT
+
+// Scroll Lock is Fn, holding layer 1; Fn+PrtSc is Scroll Lock.
+#define BASE(k) (KEY_##k == KEY_SCROLL_LOCK ? KEY_FN(1) : KEY_##k)
+
+// The layers above 0 name the switches they change by their keys in
+// layout.txt, so they follow the switches to another matrix; the switches
+// not named pass through.
+#define IS(k, name) (KEY_##k == KEY_##name)
+
+// 1, Fn: F11 and F12 on F9 and F10, GUI on Alt, and Num Lock switching
+// the keypad layer. No Pause: its code is SysReq's (layout.h).
+#define FN(k) ( \
+	IS(k, F9) ? KEY_F11 : \
+	IS(k, F10) ? KEY_F12 : \
+	IS(k, MOD_ALT) ? KEY_MOD_GUI : \
+	IS(k, NUM_LOCK) ? KEY_FN_LOCK(2) : \
+	IS(k, PRINTSCREEN) ? KEY_SCROLL_LOCK : ____)
+
+// 2, keypad: 7 8 9 0 / U I O P / J K L ; / M . / as on a laptop, and
+// Enter as the keypad's
+#define KEYPAD(k) ( \
+	IS(k, 7) ? KEYPAD_7 : IS(k, 8) ? KEYPAD_8 : IS(k, 9) ? KEYPAD_9 : \
+	IS(k, 0) ? KEYPAD_ASTERIX : \
+	IS(k, U) ? KEYPAD_4 : IS(k, I) ? KEYPAD_5 : IS(k, O) ? KEYPAD_6 : \
+	IS(k, P) ? KEYPAD_MINUS : \
+	IS(k, J) ? KEYPAD_1 : IS(k, K) ? KEYPAD_2 : IS(k, L) ? KEYPAD_3 : \
+	IS(k, SEMICOLON) ? KEYPAD_PLUS : \
+	IS(k, M) ? KEYPAD_0 : IS(k, PERIOD) ? KEYPAD_PERIOD : \
+	IS(k, SLASH) ? KEYPAD_SLASH : \
+	IS(k, ENTER) ? KEYPAD_ENTER : ____)
+
+static const uint8_t layers[NUM_LAYERS][NUM_ROWS][NUM_COLUMNS] PROGMEM = {
+	{ KEYS(BASE) },
+	{ KEYS(FN) },
+	{ KEYS(KEYPAD) },
+};
+
+static uint8_t layers_on = 1;	// a bit per layer; 0 is always on
+static uint8_t top = 0;		// the highest layer on
+// the layer each switch held was pressed on, a bit of it per plane
+static uint8_t pressed_on[2][NUM_ROWS];
+
+static void set_layer(uint8_t n, uint8_t on)
+{
+	if (on) layers_on |= 1 << n;
+	else layers_on &= ~(1 << n);
+	layers_on |= 1;
+	for (top = NUM_LAYERS - 1; !(layers_on & (1 << top)); top--) ;
+}
+
+// act on a layer key going down or up
+static void layer_key(uint8_t code, uint8_t down)
+{
+	uint8_t n = code & 0x07;
+
+	if (code & 0x08) {
+		if (down) set_layer(n, !(layers_on & (1 << n)));
+	} else {
+		set_layer(n, down);
+	}
+}
+
+uint8_t keymap_press(uint8_t row, uint8_t col)
+{
+	uint8_t layer = top, code;
+
+	for (;;) {
+		code = pgm_read_byte(&layers[layer][row][col]);
+		if (code != KEY_TRANSPARENT || layer == 0) break;
+		while (!(layers_on & (1 << --layer))) ;
+	}
+	if (code == KEY_TRANSPARENT) code = KEY_NONE;
+	if (layer & 1) pressed_on[0][row] |= 1 << col;
+	else pressed_on[0][row] &= ~(1 << col);
+	if (layer & 2) pressed_on[1][row] |= 1 << col;
+	else pressed_on[1][row] &= ~(1 << col);
+	if (IS_LAYER_KEY(code)) {
+		layer_key(code, 1);
+		return KEY_NONE;
+	}
+	return code;
+}
+
+uint8_t keymap_release(uint8_t row, uint8_t col)
+{
+	uint8_t layer = 0, code;
+
+	if (pressed_on[0][row] & (1 << col)) layer |= 1;
+	if (pressed_on[1][row] & (1 << col)) layer |= 2;
+	code = pgm_read_byte(&layers[layer][row][col]);
+	if (code == KEY_TRANSPARENT) code = KEY_NONE;
+	if (IS_LAYER_KEY(code)) {
+		layer_key(code, 0);
+		return KEY_NONE;
+	}
+	return code;
+}
@@ -0,0 +1,26 @@
+#ifndef keymap_h__
+#define keymap_h__
+
+#include <stdint.h>
+#include "layout.h"
+
+// The keys the switches send come from a stack of layers in flash
+// (keymap.c): layer 0 is KEYS(), and each layer above sends its own key
+// for a switch or passes it to the layers below.  Besides the codes of
+// layout.h a layer may hold these.
+#define NUM_LAYERS 3		// up to 4
+#define KEY_TRANSPARENT 0xFF	// whatever the layers below send
+#define KEY_LAYER_BITS 0xC0
+#define KEY_FN(n) (KEY_LAYER_BITS | (n))	// layer n while held
+#define KEY_FN_LOCK(n) (KEY_LAYER_BITS | 0x08 | (n))	// layer n on or off
+#define IS_LAYER_KEY(code) \
+	(((code) & KEY_LAYER_BITS) == KEY_LAYER_BITS && (code) != KEY_TRANSPARENT)
+
+// The key a switch sends, from the highest layer on that does not pass it
+// through, or KEY_NONE for a layer key, which is acted on here.
+// keymap_release() gives the key from the layer the switch was pressed on,
+// whatever layers went on or off meanwhile.
+uint8_t keymap_press(uint8_t row, uint8_t col);
+uint8_t keymap_release(uint8_t row, uint8_t col);
+
+#endif
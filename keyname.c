@@ -0,0 +1,65 @@
+/* Key names for the AGI 286/12 keyboard.
+ * Copyright (c) 2013 W. Owen Parry
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <avr/pgmspace.h>
+#include "keyname.h"
+
+// Names run together, a name that ends another starting inside it, and
+// found from each switch by a byte numbering the names rather than by a
+// fixed-width slot per switch.  A name's start takes a byte only while
+// the pool fits in 256 bytes, and two past that.
+#if KEY_NAME_POOL_SIZE <= 256
+typedef uint8_t name_offset;
+#else
+typedef uint16_t name_offset;
+#endif
+
+static const char pool[KEY_NAME_POOL_SIZE] PROGMEM = KEY_NAME_POOL;
+#define NAME_START(k, at) at,
+static const name_offset name_start[NUM_KEY_NAMES] PROGMEM = { KEY_NAMES(NAME_START) };
+#define NAME_CODE(k, at) KEY_##k,
+static const uint8_t name_code[NUM_KEY_NAMES] PROGMEM = { KEY_NAMES(NAME_CODE) };
+static const uint8_t switch_name[NUM_ROWS][NUM_COLUMNS] PROGMEM = KEY_NAME_INDEX;
+
+static const char *name(uint8_t n)
+{
+#if KEY_NAME_POOL_SIZE <= 256
+	return pool + pgm_read_byte(&name_start[n]);
+#else
+	return pool + pgm_read_word(&name_start[n]);
+#endif
+}
+
+const char *keyname_at(uint8_t row, uint8_t col)
+{
+	return name(pgm_read_byte(&switch_name[row][col]));
+}
+
+const char *keyname_of(uint8_t code)
+{
+	uint8_t n;
+
+	for (n=0; n<NUM_KEY_NAMES; n++) {
+		if (pgm_read_byte(&name_code[n]) == code) return name(n);
+	}
+	return 0;
+}
@@ -0,0 +1,15 @@
+#ifndef keyname_h__
+#define keyname_h__
+
+#include <stdint.h>
+#include "layout.h"
+
+// Key names as in layout.txt, each kept once in flash (layout_matrix.h).
+// Both return a string in flash, for print_P().  keyname_of() takes a
+// code of layout.h as KEYS() gives it, not one the keymap sends: it finds
+// SCROLL_LOCK, which keymap.c makes Fn, and no layer key.
+const char *keyname_at(uint8_t row, uint8_t col);	// of a switch
+const char *keyname_of(uint8_t code);	// of the first switch with code in
+					// KEYS(), or 0 if none has it
+
+#endif
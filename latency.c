@@ -0,0 +1,95 @@
+/* Keypress to report latency for the AGI 286/12 keyboard.
+ * Copyright (c) 2013 W. Owen Parry
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "latency.h"
+#include "print.h"
+
+#if LATENCY_STATS
+// Stamps are Timer 1 counts, which the scanner runs freely at F_CPU/8 and
+// which wrap every 32ms, with bit 0 set so that a stamp is never 0.
+#define TICKS_PER_US (F_CPU / 8000000UL)
+#define WRAP_FRAMES 31	// queued this many frames: too long to time
+#define TOO_LONG 0xFFFF
+
+volatile uint16_t latency_counts[LATENCY_BUCKETS];
+volatile uint16_t latency_max_us = 0;
+volatile uint16_t latency_sample_time[NUM_ROWS];
+uint16_t latency_pass_time[NUM_ROWS];
+
+void latency_found(uint8_t row)
+{
+	if (!keyboard_report_stamp) {
+		keyboard_report_stamp = latency_pass_time[row] | 1;
+	}
+}
+
+// called from the interrupt that commits a stamped report
+void usb_report_sent(uint16_t stamp, uint8_t frames)
+{
+	uint16_t us, t;
+	uint8_t bucket = 0;
+
+	if (frames >= WRAP_FRAMES) {
+		us = TOO_LONG;
+	} else {
+		us = (uint16_t)(TCNT1 - stamp) / TICKS_PER_US;
+	}
+	for (t = us >> 7; t && bucket < LATENCY_BUCKETS - 1; t >>= 1) {
+		bucket++;
+	}
+	latency_counts[bucket]++;
+	if (us > latency_max_us) latency_max_us = us;
+}
+
+void latency_print(void)
+{
+	uint16_t counts[LATENCY_BUCKETS], max_us;
+	uint8_t i;
+
+	cli();
+	for (i=0; i<LATENCY_BUCKETS; i++) {
+		counts[i] = latency_counts[i];
+		latency_counts[i] = 0;
+	}
+	max_us = latency_max_us;
+	latency_max_us = 0;
+	sei();
+	print("latency:");
+	for (i=0; i<LATENCY_BUCKETS - 1; i++) {
+		print(" <");
+		pdec(128 << i);
+		print("us ");
+		pdec(counts[i]);
+	}
+	print(", more ");
+	pdec(counts[i]);
+	print(", max ");
+	if (max_us == TOO_LONG) {
+		print("over 30ms\n");
+	} else {
+		pdec(max_us);
+		print("us\n");
+	}
+}
+#endif
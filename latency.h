@@ -0,0 +1,37 @@
+#ifndef latency_h__
+#define latency_h__
+
+#include <stdint.h>
+#include <avr/io.h>
+#include "usb_keyboard_debug.h"
+#include "layout.h"
+
+// Time from the sample that shows a key change to the report carrying it
+// being committed to the endpoint, kept as a histogram of LATENCY_BUCKETS
+// doubling buckets from 128us up, and the longest seen.  Set LATENCY_STATS
+// in the Makefile; it needs the debug channel to be shown.
+#define LATENCY_BUCKETS 8
+
+#if LATENCY_STATS
+extern volatile uint16_t latency_counts[LATENCY_BUCKETS];
+extern volatile uint16_t latency_max_us;
+extern volatile uint16_t latency_sample_time[NUM_ROWS];
+
+// the scanner has sampled a row (from its interrupt)
+#define latency_sampled(row) (latency_sample_time[row] = TCNT1)
+// keep the time a row was sampled along with the pass read from it, with
+// interrupts disabled so that both come from the same pass
+#define latency_snapshot(row) (latency_pass_time[row] = latency_sample_time[row])
+extern uint16_t latency_pass_time[NUM_ROWS];
+// a change was found on a row: stamp the next report with the time that
+// row was sampled, unless an earlier change already has
+void latency_found(uint8_t row);
+// print the histogram on the debug channel and start it again
+void latency_print(void);
+#else
+#define latency_sampled(row)
+#define latency_snapshot(row)
+#define latency_found(row)
+#endif
+
+#endif
@@ -0,0 +1,54 @@
+/* Physical layout of the AGI 286/12 keyboard matrix.
+ * Copyright (c) 2013 W. Owen Parry
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef layout_h__
+#define layout_h__
+
+#include "usb_keyboard_debug.h"
+
+// Shared by the firmware and the host-side simulator, so that both agree
+// on which pin drives which row and what each switch is called.  The
+// matrix itself is described in layout.txt, which tools/layout_gen.c makes
+// into layout_matrix.h: NUM_ROWS, NUM_COLUMNS, the row and column pin
+// tables and KEYS(), a row of oP(name) per matrix row.
+#include "layout_matrix.h"
+
+#define NUM_MODIFIER_KEYS 5
+
+#define KEY_NONE 0
+#define KEY_SYS_REQ KEY_PAUSE
+
+#define CODE(k) KEY_##k
+#define NAME(k) #k
+
+#define KEY_MODIFIER_BIT 	(1<<7)
+#define KEY_MODIFIER_INDEX_MASK (KEY_MODIFIER_BIT - 1)
+#define KEY_MOD_LEFT_SHIFT  (KEY_MODIFIER_BIT | 0)
+#define KEY_MOD_RIGHT_SHIFT (KEY_MODIFIER_BIT | 1)
+#define KEY_MOD_CTRL 		(KEY_MODIFIER_BIT | 2)
+#define KEY_MOD_ALT 		(KEY_MODIFIER_BIT | 3)
+#define KEY_MOD_GUI 		(KEY_MODIFIER_BIT | 4)	// no switch; see keymap.c
+
+// HID modifier bit for each KEY_MOD_* index, in index order
+#define MODIFIER_CODES { KEY_LEFT_SHIFT, KEY_RIGHT_SHIFT, KEY_CTRL, KEY_ALT, KEY_GUI }
+
+#endif
@@ -0,0 +1,405 @@
+/* Sequences recorded on the AGI 286/12 keyboard, kept in EEPROM.
+ * Copyright (c) 2013 W. Owen Parry
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <string.h>
+#include <avr/io.h>
+#include "macro.h"
+
+static uint8_t arena[MACRO_ARENA_SIZE];
+static uint16_t arena_used = 0;
+static uint16_t seq_start[NUM_SEQUENCES], seq_size[NUM_SEQUENCES];
+static keys_state recorded;	// the last report added
+uint8_t macro_recording = NO_SEQUENCE;
+
+// Before a report, a 0 that does not end one is followed by the frames
+// since the report before, 7 bits a byte, low first, with the top bit set
+// on all but the last; a gap of a frame or less is not kept.
+#define GAP_MAX 0x3FFF		// frames, in 2 bytes
+static uint16_t gap;		// frames since the last report added
+static uint16_t gap_frame;	// the frame number gap was counted to
+
+// A record is MACRO_TAG, the sequence, a 32 bit serial number (the higher
+// the newer, and never wrapping in the EEPROM's life), the number of bytes
+// of the sequence (low byte first), those bytes, then two running sums of
+// all the bytes before.
+#define MACRO_TAG 0xA6
+#define HEADER_SIZE 8
+#define RECORD_MAX (HEADER_SIZE + MACRO_ARENA_SIZE + 2)
+
+// enough that with the newest records taking at most two arenas (a
+// sequence's old record stays until its new one is written), some gap
+// between them still has room for a record of the whole arena
+#if MACRO_EEPROM_END - MACRO_EEPROM_ADDR < 2 * (MACRO_ARENA_SIZE \
+	+ NUM_SEQUENCES * (HEADER_SIZE + 2)) + (NUM_SEQUENCES + 1) * RECORD_MAX
+#error "the EEPROM is too small for MACRO_ARENA_SIZE"
+#endif
+
+// where the newest record of each sequence is, of size 0 for none yet
+static uint16_t live_addr[NUM_SEQUENCES];
+static uint16_t live_size[NUM_SEQUENCES];
+static uint32_t live_serial[NUM_SEQUENCES];
+static uint16_t head = MACRO_EEPROM_ADDR;	// just after the newest record
+static uint32_t serial = 0;	// for the next record
+
+// the header and sums of the record being read or written, its sequence's
+// bytes being read from the arena as they are written, and the sequences
+// waiting to be
+static uint8_t record[HEADER_SIZE + 2];
+static uint16_t record_size = 0, record_pos, record_addr;
+static uint16_t waiting = 0;
+uint8_t macro_writing = 0;
+
+#define RECORD_SEQUENCE (record[1])
+#define RECORD_CODE_SIZE (record[6] | (uint16_t)record[7] << 8)
+
+static void sum_byte(uint8_t *a, uint8_t *b, uint8_t byte)
+{
+	*a += byte;
+	*b += *a;
+}
+
+static uint32_t record_serial(void)
+{
+	return record[2] | (uint32_t)record[3] << 8
+		| (uint32_t)record[4] << 16 | (uint32_t)record[5] << 24;
+}
+
+// Close up the gap of sequence n's bytes, leaving it empty and last.
+static void drop_sequence(uint8_t n)
+{
+	uint16_t start = seq_start[n], size = seq_size[n];
+	uint8_t i;
+
+	memmove(arena + start, arena + start + size,
+		arena_used - start - size);
+	arena_used -= size;
+	for (i=0; i<NUM_SEQUENCES; i++) {
+		if (seq_start[i] > start) seq_start[i] -= size;
+	}
+	seq_start[n] = arena_used;
+	seq_size[n] = 0;
+}
+
+// Code the change from one report to the next into out, returning the
+// bytes used, or 0 if it needs more than room.
+static uint8_t code_report(uint8_t *out, uint16_t room,
+	const keys_state *from, const keys_state *to)
+{
+	uint8_t n = 0, i, changed, code;
+
+	for (i=0; i<=KEYBOARD_KEYS_SIZE; i++) {
+		if (i == 0) {
+			changed = from->keyboard_modifier_keys ^ to->keyboard_modifier_keys;
+			code = KEYLOG_MODIFIER_CODE(0);
+		} else {
+			changed = from->keyboard_keys[i - 1] ^ to->keyboard_keys[i - 1];
+			code = (i - 1) * 8;
+		}
+		for (; changed; changed >>= 1, code++) {
+			if (!(changed & 1)) continue;
+			if (n == room) return 0;
+			out[n++] = code;
+		}
+	}
+	if (n == 0) {
+		if (room == 0) return 0;
+		out[n++] = 0;
+	}
+	out[n - 1] |= KEYLOG_LAST_CHANGE;
+	return n;
+}
+
+// Count the frames since the last report added, from the 11 bit USB
+// frame number, so at least once a second while recording.
+static void count_frames(void)
+{
+	uint16_t frame = (UDFNUMH << 8) | UDFNUML;
+
+	gap += (frame - gap_frame) & 0x7FF;
+	if (gap > GAP_MAX) gap = GAP_MAX;
+	gap_frame = frame;
+}
+
+void macro_record(uint8_t n)
+{
+	uint8_t i;
+
+	macro_stop();
+	// a record being written of the bytes about to go is dropped; one of
+	// another sequence reads on wherever its bytes move to
+	if (record_size && RECORD_SEQUENCE == n) record_size = 0;
+	waiting &= ~(1 << n);
+	drop_sequence(n);
+	macro_recording = n;
+	count_frames();
+	recorded.keyboard_modifier_keys = 0;
+	for (i=0; i<KEYBOARD_KEYS_SIZE; i++) recorded.keyboard_keys[i] = 0;
+}
+
+uint8_t macro_add(const keys_state *now)
+{
+	uint8_t before = 0, used;
+
+	if (macro_recording == NO_SEQUENCE) return 1;
+	count_frames();
+	if (seq_size[macro_recording] && gap > 1) {
+		before = gap < 0x80 ? 2 : 3;
+		if (MACRO_ARENA_SIZE - arena_used < before) return 0;
+	}
+	used = code_report(arena + arena_used + before,
+		MACRO_ARENA_SIZE - arena_used - before, &recorded, now);
+	if (!used) return 0;
+	if (before) {
+		arena[arena_used] = 0;
+		arena[arena_used + 1] = gap & 0x7F;
+		if (before == 3) {
+			arena[arena_used + 1] |= 0x80;
+			arena[arena_used + 2] = gap >> 7;
+		}
+	}
+	arena_used += before + used;
+	seq_size[macro_recording] += before + used;
+	recorded = *now;
+	gap = 0;
+	return 1;
+}
+
+static void macro_save(uint8_t n)
+{
+	waiting |= 1 << n;
+	macro_writing = 1;
+}
+
+void macro_stop(void)
+{
+	if (macro_recording == NO_SEQUENCE) return;
+	macro_save(macro_recording);
+	macro_recording = NO_SEQUENCE;
+}
+
+void macro_start(uint8_t n, struct macro_cursor *c)
+{
+	c->pos = seq_start[n];
+	c->end = seq_start[n] + seq_size[n];
+	c->state.keyboard_modifier_keys = 0;
+	memset(c->state.keyboard_keys, 0, KEYBOARD_KEYS_SIZE);
+}
+
+uint8_t macro_empty(uint8_t n)
+{
+	return seq_size[n] == 0;
+}
+
+uint8_t macro_next(struct macro_cursor *c)
+{
+	uint8_t code, shift;
+
+	if (c->pos == c->end) return 0;
+	do {
+		code = arena[c->pos++];
+		keylog_flip(&c->state, code);
+	} while (!(code & KEYLOG_LAST_CHANGE));
+	c->delay = 0;
+	if (c->pos != c->end && arena[c->pos] == 0) {
+		c->pos++;
+		shift = 0;
+		do {
+			code = arena[c->pos++];
+			c->delay |= (uint16_t)(code & 0x7F) << shift;
+			shift += 7;
+		} while (code & 0x80);
+	}
+	return 1;
+}
+
+// Make the header and sums of the next record, of sequence n.
+static void make_record(uint8_t n)
+{
+	uint16_t size = seq_size[n], i;
+	uint8_t a = 0, b = 0;
+
+	record[0] = MACRO_TAG;
+	record[1] = n;
+	record[2] = serial;
+	record[3] = serial >> 8;
+	record[4] = serial >> 16;
+	record[5] = serial >> 24;
+	record[6] = size;
+	record[7] = size >> 8;
+	serial++;
+	for (i=0; i<HEADER_SIZE; i++) sum_byte(&a, &b, record[i]);
+	for (i=0; i<size; i++) sum_byte(&a, &b, arena[seq_start[n] + i]);
+	record[HEADER_SIZE] = a;
+	record[HEADER_SIZE + 1] = b;
+	record_size = HEADER_SIZE + size + 2;
+}
+
+// byte pos of the record being written
+static uint8_t record_byte(uint16_t pos)
+{
+	uint16_t size = RECORD_CODE_SIZE;
+
+	if (pos < HEADER_SIZE) return record[pos];
+	if (pos < HEADER_SIZE + size) {
+		return arena[seq_start[RECORD_SEQUENCE] + pos - HEADER_SIZE];
+	}
+	return record[pos - size];
+}
+
+// Check the record at addr, reading its header, and return its size, or 0
+// if there is no good one there.
+static uint16_t read_record(uint16_t addr)
+{
+	uint16_t size, i;
+	uint8_t a = 0, b = 0;
+
+	if (addr + HEADER_SIZE + 2 > MACRO_EEPROM_END) return 0;
+	if (eeprom_read_byte((const uint8_t *)addr) != MACRO_TAG) return 0;
+	eeprom_read_block(record, (const void *)addr, HEADER_SIZE);
+	if (RECORD_SEQUENCE >= NUM_SEQUENCES
+	  || RECORD_CODE_SIZE > MACRO_ARENA_SIZE) return 0;
+	size = HEADER_SIZE + RECORD_CODE_SIZE;
+	if (addr + size + 2 > MACRO_EEPROM_END) return 0;
+	for (i=0; i<size; i++) {
+		sum_byte(&a, &b, eeprom_read_byte((const uint8_t *)(addr + i)));
+	}
+	if (eeprom_read_byte((const uint8_t *)(addr + size)) != a
+	  || eeprom_read_byte((const uint8_t *)(addr + size + 1)) != b) {
+		return 0;
+	}
+	// the last report must end
+	if (RECORD_CODE_SIZE && !(eeprom_read_byte((const uint8_t *)(addr + size
+	  - 1)) & KEYLOG_LAST_CHANGE)) return 0;
+	return size + 2;
+}
+
+// Add sequence n from its newest record, or leave it empty if it does not
+// fit (only if saved with a bigger arena).
+static void load_sequence(uint8_t n)
+{
+	uint16_t size = live_size[n] - HEADER_SIZE - 2;
+
+	seq_start[n] = arena_used;
+	if (size > MACRO_ARENA_SIZE - arena_used) return;
+	eeprom_read_block(arena + arena_used,
+		(const void *)(live_addr[n] + HEADER_SIZE), size);
+	arena_used += size;
+	seq_size[n] = size;
+}
+
+// One pass over the ring finding the newest record of each sequence, then
+// those are loaded.
+void macro_load(void)
+{
+	uint16_t addr = MACRO_EEPROM_ADDR, size;
+	uint32_t newest = 0;
+	uint8_t n, any = 0;
+
+	arena_used = 0;
+	for (n=0; n<NUM_SEQUENCES; n++) {
+		seq_start[n] = 0;
+		seq_size[n] = 0;
+		live_size[n] = 0;
+	}
+	macro_recording = NO_SEQUENCE;
+	head = MACRO_EEPROM_ADDR;
+	record_size = 0;
+	waiting = 0;
+	macro_writing = 0;
+	while (addr < MACRO_EEPROM_END) {
+		size = read_record(addr);
+		if (!size) {
+			addr++;
+			continue;
+		}
+		n = RECORD_SEQUENCE;
+		if (!live_size[n] || (int32_t)(record_serial() - live_serial[n]) > 0) {
+			live_addr[n] = addr;
+			live_size[n] = size;
+			live_serial[n] = record_serial();
+		}
+		if (!any || (int32_t)(record_serial() - newest) > 0) {
+			newest = record_serial();
+			head = addr + size;
+			any = 1;
+		}
+		addr += size;
+	}
+	serial = newest + 1;
+	for (n=0; n<NUM_SEQUENCES; n++) {
+		if (live_size[n]) load_sequence(n);
+	}
+}
+
+// The first place from head, wrapping, with room for a record that
+// overlaps no sequence's newest record, or 0 if there is none.
+static uint16_t find_room(uint16_t size)
+{
+	uint16_t addr = head;
+	uint8_t tries, i;
+
+	for (tries=0; tries<2 * NUM_SEQUENCES + 2; tries++) {
+		if (addr + size > MACRO_EEPROM_END) addr = MACRO_EEPROM_ADDR;
+		for (i=0; i<NUM_SEQUENCES; i++) {
+			if (live_size[i] && addr < live_addr[i] + live_size[i]
+			  && live_addr[i] < addr + size) break;
+		}
+		if (i == NUM_SEQUENCES) return addr;
+		addr = live_addr[i] + live_size[i];
+	}
+	return 0;
+}
+
+// The old record of a sequence stays its newest until the last byte of the
+// new one is written, so a record cut short by a power loss is ignored.
+void macro_poll(void)
+{
+	uint8_t n;
+
+	if (macro_recording != NO_SEQUENCE) count_frames();
+	if (!record_size) {
+		if (!waiting) {
+			macro_writing = 0;
+			return;
+		}
+		for (n=0; !(waiting & (1 << n)); n++) ;
+		waiting &= ~(1 << n);
+		make_record(n);
+		record_addr = find_room(record_size);
+		if (!record_addr) {
+			record_size = 0;	// cannot happen with the ring this size
+			return;
+		}
+		record_pos = 0;
+	}
+	if (!eeprom_is_ready()) return;
+	eeprom_update_byte((uint8_t *)(record_addr + record_pos),
+		record_byte(record_pos));
+	if (++record_pos < record_size) return;
+	n = RECORD_SEQUENCE;
+	live_addr[n] = record_addr;
+	live_size[n] = record_size;
+	live_serial[n] = record_serial();
+	head = record_addr + record_size;
+	record_size = 0;
+	macro_writing = waiting != 0;
+}
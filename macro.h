@@ -0,0 +1,58 @@
+#ifndef macro_h__
+#define macro_h__
+
+#include <stdint.h>
+#include <avr/eeprom.h>
+#include "keylog.h"
+#include "matrix.h"
+
+// Sequences recorded with SysReq+P then 1-9, as the reports sent while
+// recording, for SysReq+1-9 to replay; key 1 is sequence 0.
+#define NUM_SEQUENCES 9
+#define NO_SEQUENCE 0xFF
+
+// The sequences share an arena of MACRO_ARENA_SIZE bytes, coding each
+// report as the log does (keylog.h, with a lone code 0 for a report that
+// changed nothing), so one sequence may take all of it.  A sequence being
+// recorded is last in the arena; recording one over closes up its old gap.
+#ifndef MACRO_ARENA_SIZE
+#define MACRO_ARENA_SIZE 256
+#endif
+
+// macro_record() empties sequence n and records into it, macro_add()
+// adds a report, returning 0 (and adding nothing) when the arena is full,
+// and macro_stop() ends the recording and saves it.  Not while a sequence
+// is replayed.  The frames from each report to the next are kept too, so
+// call macro_poll() at least once a second while recording to count them.
+extern uint8_t macro_recording;	// the sequence, or NO_SEQUENCE
+void macro_record(uint8_t n);
+uint8_t macro_add(const keys_state *now);
+void macro_stop(void);
+
+// Replay: macro_start() then macro_next() gives each report of sequence n
+// in state, until it returns 0, and in delay the frames recorded from it
+// to the next (0 for a frame or less).
+struct macro_cursor {
+	uint16_t pos, end;
+	keys_state state;
+	uint16_t delay;
+};
+void macro_start(uint8_t n, struct macro_cursor *c);
+uint8_t macro_next(struct macro_cursor *c);
+uint8_t macro_empty(uint8_t n);
+
+// Each sequence saved is appended to a ring of records in the EEPROM after
+// the matrix's, the newest record for a sequence being the one loaded at
+// startup.  Records go wherever the ring is free of those, so its bytes
+// wear evenly.
+#define MACRO_EEPROM_ADDR (MATRIX_EEPROM_ADDR + MATRIX_EEPROM_SIZE)
+#define MACRO_EEPROM_END (E2END + 1)
+
+void macro_load(void);		// read the saved sequences, at startup
+
+// macro_poll() writes a byte of the record being saved when the EEPROM is
+// ready for it; call it often while macro_writing is set (or recording).
+extern uint8_t macro_writing;
+void macro_poll(void);
+
+#endif
@@ -0,0 +1,401 @@
+/* Timer-driven matrix scanner for the AGI 286/12 keyboard.
+ * Copyright (c) 2013 W. Owen Parry
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <avr/eeprom.h>
+#include <util/delay.h>
+#include "matrix.h"
+#include "debounce.h"
+#include "latency.h"
+#include "profile.h"
+
+// Timer 1 runs freely at F_CPU/8; compare A is moved along to interrupt
+// once per row.
+#define TICKS(us) ((uint16_t)((us) * (F_CPU / 8000000UL)))
+
+#if SCAN_LEAD_US
+// A full pass should end SCAN_LEAD_US before each start of frame, so row 0
+// is sampled the rest of the pass before that (first_row_delay) after SOF.
+// This holds even with every row at SCAN_ROW_US.
+#define SOF_DELAY_US (1000 - SCAN_LEAD_US - (NUM_ROWS - 1) * SCAN_ROW_US)
+#if SOF_DELAY_US < SCAN_ROW_US
+#error "SCAN_ROW_US is too long to fit a pass in a frame before SCAN_LEAD_US"
+#endif
+#define PASS_PERIOD_US (1000 - SCAN_LEAD_US)	// from SOF
+// without a start of frame (USB suspended), carry on unlocked
+#define SOF_TIMEOUT_US 1500
+#else
+#define PASS_PERIOD_US SCAN_PASS_US	// from the end of the pass before
+#endif
+
+// the pin driving each row, on each row port (layout_matrix.h)
+#define ROW_TABLE(P) static const uint8_t row_bits_##P[NUM_ROWS] = ROW_BITS_##P;
+ROW_PORTS(ROW_TABLE)
+
+volatile uint8_t matrix_cols[NUM_ROWS];
+volatile uint8_t matrix_pending[NUM_ROWS];
+volatile uint16_t matrix_passes = 0;
+volatile uint16_t matrix_probes = 0;
+volatile uint16_t matrix_sof_lead_us = 0;
+volatile uint16_t matrix_sof_late = 0;
+uint8_t matrix_settle_from = SETTLE_DEFAULT;
+uint8_t matrix_rise_us[NUM_ROWS];
+uint8_t matrix_settle_us[NUM_ROWS];
+uint16_t matrix_pass_us;
+static uint8_t search_settle_us;	// the longest, for several rows at once
+static uint16_t first_row_delay;	// see PASS_PERIOD_US
+static volatile uint8_t pass_ready = 0;
+static volatile uint8_t woken = 0;	// by matrix_wake()
+static uint8_t awaiting_sof = 0;
+static uint16_t pass_end;
+
+// While a key is held or still debouncing every row is sampled in turn.
+// Otherwise all rows are driven together, and only if that finds something
+// are the rows halved until each closed switch is pinned to one row.  Rows
+// found open then need no debouncing, as nothing on them is held or settling.
+#define SCAN_ROWS	0
+#define SCAN_SEARCH	1
+static uint8_t scan_mode = SCAN_SEARCH;
+static uint8_t scan_row = 0;		// SCAN_ROWS: row being driven
+static uint8_t held = 0;		// columns closed or settling this pass
+
+// SCAN_SEARCH: rows being driven, and those still to try, as
+// (first << 4 | count) over the scan order
+#define RANGE(first, count) (((first) << 4) | (count))
+#define RANGE_FIRST(r) ((r) >> 4)
+#define RANGE_COUNT(r) ((r) & 15)
+#define MAX_RANGES 8
+static uint8_t range = RANGE(0, NUM_ROWS);
+static uint8_t ranges[MAX_RANGES];
+static uint8_t num_ranges = 0;
+
+// columns are inputs with pull-ups
+static void init_columns(void)
+{
+#define PULL_UP(P) DDR##P &= (uint8_t)~COLUMN_PINS_##P; PORT##P |= COLUMN_PINS_##P;
+	COLUMN_PORTS(PULL_UP)
+}
+
+static uint8_t read_columns(void)
+{
+#define READ_PINS(P) uint8_t pins_##P = ~PIN##P;
+#define PINS(P) pins_##P
+	COLUMN_PORTS(READ_PINS)
+	return READ_COLUMNS(PINS);
+}
+
+// drive the row low, touching every row port so as not to branch
+static void select_row(uint8_t row)
+{
+#define DRIVE(P) DDR##P |= row_bits_##P[row]; PORT##P &= ~row_bits_##P[row];
+	ROW_PORTS(DRIVE)
+}
+
+static void unselect_rows(void)
+{
+	// switch to high-impedence ie floating input
+#define FLOAT(P) DDR##P &= (uint8_t)~ROW_PINS_##P; PORT##P &= (uint8_t)~ROW_PINS_##P;
+	ROW_PORTS(FLOAT)
+}
+
+static void select_rows(uint8_t r)
+{
+#define NO_BITS(P) uint8_t bits_##P = 0;
+#define ADD_BITS(P) bits_##P |= row_bits_##P[i];
+#define DRIVE_BITS(P) DDR##P |= bits_##P; PORT##P &= ~bits_##P;
+	ROW_PORTS(NO_BITS)
+	uint8_t i;
+
+	for (i=RANGE_FIRST(r); i<RANGE_FIRST(r) + RANGE_COUNT(r); i++) {
+		ROW_PORTS(ADD_BITS)
+	}
+	ROW_PORTS(DRIVE_BITS)
+}
+
+// Settle calibration.  A released row floats back up through the pull-up
+// of any column it is switched to, and until it has, that column still
+// reads closed on the next row.  The row's own pull-up, much the same
+// strength, shows how quickly its line rises: drive it low, let it go with
+// the pull-up on, and time it, taking the slowest of a few tries.
+#define SETTLE_MARGIN_US 4
+#define RISE_TRIES 4
+#define RISE_DRIVE_US 10
+#define RISE_MAGIC 0x5E
+
+static void pull_up_row(uint8_t row)
+{
+#define PULL_UP_ROW(P) DDR##P &= ~row_bits_##P[row]; PORT##P |= row_bits_##P[row];
+	ROW_PORTS(PULL_UP_ROW)
+}
+
+static uint8_t row_is_high(uint8_t row)
+{
+#define HIGH(P) (PIN##P & row_bits_##P[row]) |
+	return ROW_PORTS(HIGH) 0;
+}
+
+// rise time of a row in us, rounded up, or SCAN_ROW_US if it never rises
+static uint8_t measure_rise(uint8_t row)
+{
+	uint16_t start, ticks, longest = 0;
+	uint8_t i;
+
+	for (i=0; i<RISE_TRIES; i++) {
+		select_row(row);
+		_delay_us(RISE_DRIVE_US);
+		start = TCNT1;
+		pull_up_row(row);
+		do {
+			ticks = TCNT1 - start;
+		} while (!row_is_high(row) && ticks < TICKS(SCAN_ROW_US));
+		unselect_rows();
+		if (ticks > longest) longest = ticks;
+	}
+	return (longest + TICKS(1) - 1) / TICKS(1);
+}
+
+// keys held now would load their rows, so measure only with none held
+static uint8_t any_key_held(void)
+{
+	uint8_t cols;
+
+	select_rows(RANGE(0, NUM_ROWS));
+	_delay_us(SCAN_ROW_US);
+	cols = read_columns();
+	unselect_rows();
+	_delay_us(SCAN_ROW_US);
+	return cols;
+}
+
+// Measure and save the rise times, or load the saved ones.  The record is
+// RISE_MAGIC, a byte per row and the sum of those before it.
+static void find_rise_times(void)
+{
+	uint8_t saved[MATRIX_EEPROM_SIZE], sum = 0, i;
+
+	eeprom_read_block(saved, (const void *)MATRIX_EEPROM_ADDR, sizeof(saved));
+	if (!any_key_held()) {
+		saved[0] = RISE_MAGIC;
+		for (i=0; i<NUM_ROWS; i++) {
+			saved[i + 1] = measure_rise(i);
+		}
+		matrix_settle_from = SETTLE_MEASURED;
+	}
+	for (i=0; i<MATRIX_EEPROM_SIZE - 1; i++) {
+		sum += saved[i];
+	}
+	if (matrix_settle_from == SETTLE_MEASURED) {
+		saved[MATRIX_EEPROM_SIZE - 1] = sum;
+		// only the bytes that changed are written
+		eeprom_update_block(saved, (void *)MATRIX_EEPROM_ADDR, sizeof(saved));
+	} else if (saved[0] == RISE_MAGIC && saved[MATRIX_EEPROM_SIZE - 1] == sum) {
+		matrix_settle_from = SETTLE_SAVED;
+	} else {
+		return;
+	}
+	for (i=0; i<NUM_ROWS; i++) {
+		matrix_rise_us[i] = saved[i + 1];
+	}
+}
+
+static void set_settle_times(void)
+{
+	uint16_t us;
+	uint8_t i;
+
+	matrix_pass_us = 0;
+	search_settle_us = SCAN_ROW_MIN_US;
+	for (i=0; i<NUM_ROWS; i++) {
+		us = SCAN_ROW_US;
+		if (matrix_settle_from != SETTLE_DEFAULT) {
+			us = 2 * matrix_rise_us[i] + SETTLE_MARGIN_US;
+			if (us < SCAN_ROW_MIN_US) us = SCAN_ROW_MIN_US;
+			if (us > SCAN_ROW_US) us = SCAN_ROW_US;
+		}
+		matrix_settle_us[i] = us;
+		matrix_pass_us += us;
+		if (us > search_settle_us) search_settle_us = us;
+	}
+	// the rows after row 0 are each sampled once the row before settles
+	first_row_delay = TICKS(PASS_PERIOD_US)
+		- TICKS(matrix_pass_us - matrix_settle_us[NUM_ROWS - 1]);
+}
+
+void matrix_init(void)
+{
+	debounce_reset();
+	init_columns();
+	unselect_rows();
+	TCCR1A = 0;
+	TCCR1B = (1<<CS11);	// normal mode, clk/8, for measuring
+	find_rise_times();
+	set_settle_times();
+}
+
+void matrix_start(void)
+{
+	scan_mode = SCAN_SEARCH;
+	pass_end = TCNT1;
+	range = RANGE(0, NUM_ROWS);
+	select_rows(range);
+	TCCR1A = 0;
+	TCCR1B = (1<<CS11);	// normal mode, clk/8
+	OCR1A = TCNT1 + TICKS(search_settle_us);
+	TIFR1 = (1<<OCF1A);
+	TIMSK1 = (1<<OCIE1A);
+	set_sleep_mode(SLEEP_MODE_IDLE);
+}
+
+uint8_t matrix_wait_pass(void)
+{
+	cli();
+	while (!pass_ready && !woken) {
+		// sei takes effect after sleep_cpu, so a wakeup cannot be lost
+		sleep_enable();
+		sei();
+		sleep_cpu();
+		sleep_disable();
+		cli();
+	}
+	woken = 0;
+	if (!pass_ready) {
+		sei();
+		return 0;
+	}
+	pass_ready = 0;
+	sei();
+	return 1;
+}
+
+void matrix_wake(void)
+{
+	woken = 1;
+}
+
+static void end_pass(void)
+{
+	uint8_t mode = held ? SCAN_ROWS : SCAN_SEARCH;
+
+	if (held || scan_mode == SCAN_ROWS) {
+		matrix_passes++;
+		pass_ready = 1;
+	} else {
+		matrix_probes++;
+	}
+	// only row passes are profiled, each from the end of the one before
+	// or from the probe that found a key; idle probes are not passes
+	if (scan_mode == SCAN_ROWS) {
+		PROFILE_END(PASS, pass_end);
+	}
+	scan_mode = mode;
+	held = 0;
+	scan_row = 0;
+	range = RANGE(0, NUM_ROWS);
+	pass_end = TCNT1;
+}
+
+// Once per USB frame.  While keys are held, each pass is started from here
+// so that it ends, and its report is queued, just before the host polls.
+// Idle probes run freely, so the first key after idle is seen at once.
+void matrix_sof(void)
+{
+#if SCAN_LEAD_US
+	uint16_t now = TCNT1;
+
+	if (awaiting_sof) {
+		awaiting_sof = 0;
+		matrix_sof_lead_us = (now - pass_end) / TICKS(1);
+		OCR1A = now + first_row_delay;
+	} else if (scan_mode == SCAN_ROWS) {
+		matrix_sof_late++;
+	}
+#endif
+}
+
+// The driven rows have settled for a full period: sample them, release
+// them and drive the next ones, which then settle until the next interrupt.
+ISR(TIMER1_COMPA_vect)
+{
+	uint8_t cols, first, count, i;
+	// the rows driven now are released below, and must settle
+	uint16_t period = TICKS(scan_mode == SCAN_ROWS
+		? matrix_settle_us[scan_row] : search_settle_us);
+	PROFILE_START(start);
+
+	awaiting_sof = 0;
+	cols = read_columns();
+	unselect_rows();
+	held |= cols;
+	if (scan_mode == SCAN_ROWS) {
+		latency_sampled(scan_row);
+		matrix_pending[scan_row] = debounce_pending(scan_row);
+		matrix_cols[scan_row] = debounce(scan_row, cols);
+		held |= matrix_cols[scan_row] | debounce_pending(scan_row);
+		if (++scan_row == NUM_ROWS) {
+			end_pass();
+#if SCAN_LEAD_US
+			if (scan_mode == SCAN_ROWS) {
+				// row 0 settles until matrix_sof() times the next pass
+				awaiting_sof = 1;
+				period = TICKS(SOF_TIMEOUT_US);
+			}
+#else
+			if (scan_mode == SCAN_ROWS) period = first_row_delay;
+#endif
+		}
+	} else {
+		first = RANGE_FIRST(range);
+		count = RANGE_COUNT(range);
+		if (cols && count > 1) {
+			// something in here: try each half
+			ranges[num_ranges++] = RANGE(first + count/2, count - count/2);
+			ranges[num_ranges++] = RANGE(first, count/2);
+		} else if (count == 1) {
+			latency_sampled(first);
+			matrix_pending[first] = debounce_pending(first);
+			matrix_cols[first] = debounce(first, cols);
+			held |= matrix_cols[first] | debounce_pending(first);
+		} else {
+			// nothing closed on any of these rows
+			for (i=first; i<first + count; i++) {
+				latency_sampled(i);
+				matrix_cols[i] = 0;
+				matrix_pending[i] = 0;
+			}
+		}
+		if (num_ranges) {
+			range = ranges[--num_ranges];
+		} else {
+			end_pass();
+		}
+	}
+	if (scan_mode == SCAN_ROWS) {
+		select_row(scan_row);
+	} else {
+		select_rows(range);
+	}
+	// counted from now, so a late interrupt never shortens the settle time
+	OCR1A = TCNT1 + period;
+	PROFILE_END(SAMPLE, start);
+}
@@ -0,0 +1,78 @@
+#ifndef matrix_h__
+#define matrix_h__
+
+#include <stdint.h>
+#include "layout.h"
+
+// Microseconds each row is driven before its columns are sampled.  The
+// same time lets the previously driven row float back up, which is what
+// takes longest, so it is measured for each row at startup (see
+// matrix_settle_us) and kept between these bounds.  Set from the Makefile.
+#ifndef SCAN_ROW_US
+#define SCAN_ROW_US 60
+#endif
+#ifndef SCAN_ROW_MIN_US
+#define SCAN_ROW_MIN_US 10
+#endif
+#if SCAN_ROW_US > 255 || SCAN_ROW_MIN_US > SCAN_ROW_US
+#error "need SCAN_ROW_MIN_US <= SCAN_ROW_US <= 255"
+#endif
+// Passes that run freely start this far apart however quickly the rows
+// settle, as debouncing counts passes.
+#define SCAN_PASS_US ((uint32_t)SCAN_ROW_US * NUM_ROWS)
+
+// While keys are held, time each pass to end this many microseconds before
+// the USB start of frame, leaving the main loop that long to queue the
+// report before the host polls.  0 scans freely.  Set from the Makefile.
+#ifndef SCAN_LEAD_US
+#define SCAN_LEAD_US 150
+#endif
+
+#if SCAN_LEAD_US
+#define SCAN_PASS_HZ 1000UL
+#else
+#define SCAN_PASS_HZ (1000000UL / SCAN_PASS_US)
+#endif
+
+// The rise time of each row is kept in EEPROM from this address, for
+// when it cannot be measured.
+#define MATRIX_EEPROM_ADDR 0
+#define MATRIX_EEPROM_SIZE (NUM_ROWS + 2)
+
+void matrix_init(void);		// columns as inputs, rows floating, and
+					// the settle time of each row found
+void matrix_start(void);		// start the timer-driven scan
+uint8_t matrix_wait_pass(void);		// sleep until a full pass is sampled,
+					// or return 0 early for matrix_wake()
+void matrix_wake(void);			// from an interrupt
+void matrix_sof(void);			// call from the start of frame interrupt
+
+// Columns read on each row during the most recent pass, 1 = closed, and
+// those the debouncer answered for rather than the switch, as it was
+// still ignoring or counting their samples.
+extern volatile uint8_t matrix_cols[NUM_ROWS];
+extern volatile uint8_t matrix_pending[NUM_ROWS];
+// Passes completed by the scanner, and idle probes that found every
+// switch open, both wrapping.
+extern volatile uint16_t matrix_passes;
+extern volatile uint16_t matrix_probes;
+// Time from the end of the last locked pass to the start of frame that
+// followed it, and starts of frame that arrived with a pass still running.
+extern volatile uint16_t matrix_sof_lead_us;
+extern volatile uint16_t matrix_sof_late;
+
+// Time allowed for each row to float back up once released, before the
+// next row is sampled, and from the first row sampled to the last plus
+// that of the last.  Each is the row's rise time
+// doubled plus SETTLE_MARGIN_US, within the bounds above.  The rise time
+// is measured at startup while no key is held (a held key loads its row),
+// and saved; otherwise the saved one is used, or SCAN_ROW_US without one.
+#define SETTLE_DEFAULT		0
+#define SETTLE_SAVED		1
+#define SETTLE_MEASURED		2
+extern uint8_t matrix_settle_from;
+extern uint8_t matrix_rise_us[NUM_ROWS];
+extern uint8_t matrix_settle_us[NUM_ROWS];
+extern uint16_t matrix_pass_us;
+
+#endif
@@ -28,6 +28,7 @@
 
 #include "print.h"
 
+#ifdef USB_DEBUG_HID
 void print_P(const char *s)
 {
 	char c;
@@ -57,6 +58,15 @@ void phex16(unsigned int i)
 	phex(i);
 }
 
+void pdec(unsigned int i)
+{
+	if (i >= 10) pdec(i / 10);
+	usb_debug_putchar('0' + i % 10);
+}
 
-
-
+void pdec32(uint32_t i)
+{
+	if (i >= 10) pdec32(i / 10);
+	usb_debug_putchar('0' + i % 10);
+}
+#endif
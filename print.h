@@ -4,6 +4,7 @@
 #include <avr/pgmspace.h>
 #include "usb_keyboard_debug.h"
 
+#ifdef USB_DEBUG_HID
 // this macro allows you to write print("some text") and
 // the string is automatically placed into flash memory :)
 #define print(s) print_P(PSTR(s))
@@ -12,5 +13,17 @@
 void print_P(const char *s);
 void phex(unsigned char c);
 void phex16(unsigned int i);
+void pdec(unsigned int i);
+void pdec32(uint32_t i);
+#else
+// DEBUG_OFF: no debug channel, and nothing to print on it
+#define print(s) ((void)0)
+#define pchar(c) ((void)0)
+#define print_P(s) ((void)0)
+#define phex(c) ((void)0)
+#define phex16(i) ((void)0)
+#define pdec(i) ((void)0)
+#define pdec32(i) ((void)0)
+#endif
 
 #endif
@@ -0,0 +1,93 @@
+/* Scan stage profiler for the AGI 286/12 keyboard.
+ * Copyright (c) 2013 W. Owen Parry
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <avr/interrupt.h>
+#include "profile.h"
+#include "print.h"
+
+#if PROFILE
+#define CYCLES_PER_TICK 8
+#define TICKS_PER_US (F_CPU / 8000000UL)
+
+#define STAGE_NAME(s) #s,
+static const char stage_names[NUM_STAGES][8] PROGMEM = { PROFILE_STAGES(STAGE_NAME) };
+
+volatile struct profile_stage profile[NUM_STAGES];
+
+// called from the main loop and from the timer interrupt, each stage only
+// from one of them
+void profile_record(uint8_t stage, uint16_t ticks)
+{
+	volatile struct profile_stage *p = &profile[stage];
+
+	if (!p->count || ticks < p->min) p->min = ticks;
+	if (ticks > p->max) p->max = ticks;
+	p->total += ticks;
+	// start again before the average loses its meaning
+	if (++p->count == 0xFFFF) {
+		p->total = ticks;
+		p->count = 1;
+	}
+}
+
+void profile_print(void)
+{
+	struct profile_stage s;
+	uint8_t i;
+
+	for (i=0; i<NUM_STAGES; i++) {
+		cli();
+		s = profile[i];
+		profile[i].count = 0;
+		profile[i].max = 0;
+		profile[i].total = 0;
+		sei();
+		print("profile: ");
+		print_P(stage_names[i]);
+		if (!s.count) {
+			print(" none\n");
+			continue;
+		}
+		if (i == STAGE_PASS) {
+			print(" min ");
+			pdec(s.min / TICKS_PER_US);
+			print(" avg ");
+			pdec(s.total / s.count / TICKS_PER_US);
+			print(" max ");
+			pdec(s.max / TICKS_PER_US);
+			print(" us\n");
+		} else {
+			print(" min ");
+			pdec32((uint32_t)s.min * CYCLES_PER_TICK);
+			print(" avg ");
+			// in parts: the total in cycles would not fit in 32 bits
+			pdec32(s.total / s.count * CYCLES_PER_TICK
+				+ s.total % s.count * CYCLES_PER_TICK / s.count);
+			print(" max ");
+			pdec32((uint32_t)s.max * CYCLES_PER_TICK);
+			print(" cycles\n");
+		}
+	}
+}
+#endif
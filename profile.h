@@ -0,0 +1,49 @@
+#ifndef profile_h__
+#define profile_h__
+
+#include <stdint.h>
+#include <avr/io.h>
+#include "usb_keyboard_debug.h"
+
+// Cycles spent in each stage of the scan, from Timer 1, which the scanner
+// runs freely at F_CPU/8, and the period between passes.  Set PROFILE in
+// the Makefile; with it off (and always with DEBUG_LEVEL OFF) every
+// PROFILE_ macro below compiles to nothing.
+#if DEBUG_LEVEL == DEBUG_OFF
+#undef PROFILE
+#endif
+#ifndef PROFILE
+#define PROFILE 0
+#endif
+
+#define PROFILE_STAGES(X) \
+	X(SAMPLE)	/* timer interrupt: sample a row, debounce, drive the next */ \
+	X(GHOST)	/* ghost_filter() on a pass */ \
+	X(DETECT)	/* detect_changes() over every row */ \
+	X(SEND)		/* usb_keyboard_send() */ \
+	X(LOG)		/* log() */ \
+	X(PASS)		/* from the end of one pass to the end of the next */
+
+#define STAGE_ENUM(s) STAGE_##s,
+enum { PROFILE_STAGES(STAGE_ENUM) NUM_STAGES };
+
+#if PROFILE
+struct profile_stage {
+	uint16_t min, max;	// timer ticks
+	uint16_t count;
+	uint32_t total;
+};
+extern volatile struct profile_stage profile[NUM_STAGES];
+
+void profile_record(uint8_t stage, uint16_t ticks);
+// print every stage on the debug channel and start again
+void profile_print(void);
+
+#define PROFILE_START(t) uint16_t t = TCNT1
+#define PROFILE_END(stage, t) profile_record(STAGE_##stage, TCNT1 - (t))
+#else
+#define PROFILE_START(t)
+#define PROFILE_END(stage, t)
+#endif
+
+#endif
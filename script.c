@@ -0,0 +1,192 @@
+/* Scripts run by the AGI 286/12 keyboard controller from flash.
+ * Copyright (c) 2013 W. Owen Parry
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "script.h"
+
+#define SHIFTED 0x80
+
+// the key typing each ASCII character from ' ', with SHIFTED if it needs
+// shift
+static const uint8_t ascii_keys[] PROGMEM = {
+	KEY_SPACE, KEY_1|SHIFTED, KEY_QUOTE|SHIFTED, KEY_3|SHIFTED,
+	KEY_4|SHIFTED, KEY_5|SHIFTED, KEY_7|SHIFTED, KEY_QUOTE,
+	KEY_9|SHIFTED, KEY_0|SHIFTED, KEY_8|SHIFTED, KEY_EQUAL|SHIFTED,
+	KEY_COMMA, KEY_MINUS, KEY_PERIOD, KEY_SLASH,
+	KEY_0, KEY_1, KEY_2, KEY_3, KEY_4, KEY_5, KEY_6, KEY_7,
+	KEY_8, KEY_9, KEY_SEMICOLON|SHIFTED, KEY_SEMICOLON,
+	KEY_COMMA|SHIFTED, KEY_EQUAL, KEY_PERIOD|SHIFTED, KEY_SLASH|SHIFTED,
+	KEY_2|SHIFTED, KEY_A|SHIFTED, KEY_B|SHIFTED, KEY_C|SHIFTED,
+	KEY_D|SHIFTED, KEY_E|SHIFTED, KEY_F|SHIFTED, KEY_G|SHIFTED,
+	KEY_H|SHIFTED, KEY_I|SHIFTED, KEY_J|SHIFTED, KEY_K|SHIFTED,
+	KEY_L|SHIFTED, KEY_M|SHIFTED, KEY_N|SHIFTED, KEY_O|SHIFTED,
+	KEY_P|SHIFTED, KEY_Q|SHIFTED, KEY_R|SHIFTED, KEY_S|SHIFTED,
+	KEY_T|SHIFTED, KEY_U|SHIFTED, KEY_V|SHIFTED, KEY_W|SHIFTED,
+	KEY_X|SHIFTED, KEY_Y|SHIFTED, KEY_Z|SHIFTED, KEY_LEFT_BRACE,
+	KEY_BACKSLASH, KEY_RIGHT_BRACE, KEY_6|SHIFTED, KEY_MINUS|SHIFTED,
+	KEY_TILDE, KEY_A, KEY_B, KEY_C, KEY_D, KEY_E, KEY_F, KEY_G,
+	KEY_H, KEY_I, KEY_J, KEY_K, KEY_L, KEY_M, KEY_N, KEY_O,
+	KEY_P, KEY_Q, KEY_R, KEY_S, KEY_T, KEY_U, KEY_V, KEY_W,
+	KEY_X, KEY_Y, KEY_Z, KEY_LEFT_BRACE|SHIFTED,
+	KEY_BACKSLASH|SHIFTED, KEY_RIGHT_BRACE|SHIFTED, KEY_TILDE|SHIFTED
+};
+
+// the key for a character, or 0 for none
+static uint8_t ascii_key(char ch)
+{
+	if (ch == '\n') return KEY_ENTER;
+	if (ch == '\t') return KEY_TAB;
+	if (ch < ' ' || ch > '~') return 0;
+	return pgm_read_byte(&ascii_keys[ch - ' ']);
+}
+
+static void set_key(keys_state *s, uint8_t key, uint8_t down)
+{
+	uint8_t *byte, bit;
+
+	if (!key) return;
+	if (key >= KEYLOG_MODIFIER_CODE(0)) {
+		byte = &s->keyboard_modifier_keys;
+		bit = 1 << (key - KEYLOG_MODIFIER_CODE(0));
+	} else {
+		byte = &s->keyboard_keys[key >> 3];
+		bit = 1 << (key & 7);
+	}
+	if (down) *byte |= bit;
+	else *byte &= ~bit;
+}
+
+// Run the ops that send nothing, up to the next that does.
+static void settle(struct script_cursor *c)
+{
+	uint8_t op;
+
+	for (;;) {
+		op = pgm_read_byte(c->pc);
+		if (op == SCRIPT_DELAY) {
+			c->delay += pgm_read_byte(c->pc + 1);
+			c->pc += 2;
+		} else if (op == SCRIPT_REPEAT) {
+			c->repeats = pgm_read_byte(c->pc + 1);
+			c->pc += 2;
+			c->loop = c->pc;
+		} else if (op == SCRIPT_NEXT) {
+			if (c->repeats > 1) {
+				c->repeats--;
+				c->pc = c->loop;
+			} else {
+				c->pc++;
+			}
+		} else {
+			return;
+		}
+	}
+}
+
+static void tap(struct script_cursor *c, uint8_t key, uint8_t shift)
+{
+	set_key(&c->state, key, 1);
+	c->release = key;
+	c->release_shift = shift
+		&& !(c->state.keyboard_modifier_keys & (KEY_LEFT_SHIFT | KEY_RIGHT_SHIFT));
+	if (c->release_shift) set_key(&c->state, S_SHIFT, 1);
+}
+
+// the key for the next character of the text being typed that has one,
+// or 0 at the end of the text, which is then done with
+static uint8_t text_key(struct script_cursor *c)
+{
+	uint8_t key;
+	char ch;
+
+	while ((ch = pgm_read_byte(c->text))) {
+		key = ascii_key(ch);
+		if (key) return key;
+		c->text++;
+	}
+	c->text = 0;
+	return 0;
+}
+
+uint8_t script_defined(uint8_t n)
+{
+	return pgm_read_ptr(&script_programs[n]) != 0;
+}
+
+void script_start(uint8_t n, struct script_cursor *c)
+{
+	static const uint8_t none[] PROGMEM = { S_END };
+	uint8_t i;
+
+	c->pc = pgm_read_ptr(&script_programs[n]);
+	if (!c->pc) c->pc = none;
+	c->repeats = 0;
+	c->text = 0;
+	c->release = 0;
+	c->state.keyboard_modifier_keys = 0;
+	for (i=0; i<KEYBOARD_KEYS_SIZE; i++) c->state.keyboard_keys[i] = 0;
+	c->delay = 0;
+	settle(c);
+}
+
+uint8_t script_next(struct script_cursor *c)
+{
+	uint8_t op, key;
+
+	c->delay = 0;
+	if (c->release) {
+		set_key(&c->state, c->release, 0);
+		if (c->release_shift) set_key(&c->state, S_SHIFT, 0);
+		c->release = 0;
+		if (!c->text || !text_key(c)) settle(c);
+		return 1;
+	}
+	for (;;) {
+		if (c->text) {
+			key = text_key(c);
+			if (key) {
+				c->text++;
+				tap(c, key & ~SHIFTED, key & SHIFTED);
+				return 1;
+			}
+			settle(c);
+		}
+		op = pgm_read_byte(c->pc);
+		if (op == SCRIPT_END) return 0;
+		key = pgm_read_byte(c->pc + 1);
+		c->pc += 2;
+		switch (op) {
+			case SCRIPT_TAP:
+				tap(c, key, 0);
+				return 1;
+			case SCRIPT_PRESS:
+			case SCRIPT_RELEASE:
+				set_key(&c->state, key, op == SCRIPT_PRESS);
+				settle(c);
+				return 1;
+			case SCRIPT_TYPE:
+				c->text = pgm_read_ptr(&script_texts[key]);
+				break;
+			default:
+				return 0;	// not an op: stop there
+		}
+	}
+}
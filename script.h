@@ -0,0 +1,62 @@
+#ifndef script_h__
+#define script_h__
+
+#include <stdint.h>
+#include <avr/pgmspace.h>
+#include "keylog.h"
+#include "macro.h"
+
+// Scripts are programs in flash that SysReq+1-9 runs when no sequence is
+// recorded for that key (script_table.c).  Each op is a byte, some with a
+// byte after it; a key is a usage (KEY_A) or S_CTRL and the like, coded
+// as in the log.
+#define SCRIPT_END	0
+#define SCRIPT_TAP	1	// key: press it, then release it
+#define SCRIPT_PRESS	2	// key
+#define SCRIPT_RELEASE	3	// key
+#define SCRIPT_TYPE	4	// n: tap out script_texts[n], shifting as needed
+#define SCRIPT_DELAY	5	// n: wait n more frames (ms) after the last report
+#define SCRIPT_REPEAT	6	// n: run the ops up to SCRIPT_NEXT n times; not nested
+#define SCRIPT_NEXT	7
+
+#define S_END			SCRIPT_END
+#define S_TAP(key)		SCRIPT_TAP, (key)
+#define S_PRESS(key)		SCRIPT_PRESS, (key)
+#define S_RELEASE(key)		SCRIPT_RELEASE, (key)
+#define S_TYPE(n)		SCRIPT_TYPE, (n)
+#define S_DELAY(frames)		SCRIPT_DELAY, (frames)
+#define S_REPEAT(n)		SCRIPT_REPEAT, (n)
+#define S_NEXT			SCRIPT_NEXT
+
+#define S_CTRL		KEYLOG_MODIFIER_CODE(0)
+#define S_SHIFT		KEYLOG_MODIFIER_CODE(1)
+#define S_ALT		KEYLOG_MODIFIER_CODE(2)
+#define S_GUI		KEYLOG_MODIFIER_CODE(3)
+#define S_RIGHT_CTRL	KEYLOG_MODIFIER_CODE(4)
+#define S_RIGHT_SHIFT	KEYLOG_MODIFIER_CODE(5)
+#define S_RIGHT_ALT	KEYLOG_MODIFIER_CODE(6)
+#define S_RIGHT_GUI	KEYLOG_MODIFIER_CODE(7)
+
+// the program for each of keys 1-9, or 0, and the texts S_TYPE names:
+// ASCII, with \n for Enter and \t for Tab
+extern const uint8_t *const script_programs[NUM_SEQUENCES] PROGMEM;
+extern const char *const script_texts[] PROGMEM;
+
+// Replay: script_start() then script_next() gives each report of script n
+// in state, until it returns 0, and in delay the frames to wait after it
+// (from the start, before the first).
+struct script_cursor {
+	const uint8_t *pc;
+	const uint8_t *loop;	// the first op repeated
+	uint8_t repeats;	// runs left, counting this one
+	const char *text;	// the rest of a text being typed, or 0
+	uint8_t release;	// the key a tap presses, to release next, or 0
+	uint8_t release_shift;	// and if it pressed shift too
+	keys_state state;
+	uint16_t delay;
+};
+uint8_t script_defined(uint8_t n);
+void script_start(uint8_t n, struct script_cursor *c);
+uint8_t script_next(struct script_cursor *c);
+
+#endif
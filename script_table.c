@@ -0,0 +1,48 @@
+/* The scripts SysReq+1-9 runs on the AGI 286/12 keyboard; edit to taste.
+ * Copyright (c) 2013 W. Owen Parry
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "script.h"
+
+// texts for S_TYPE(n), by n
+static const char text_greeting[] PROGMEM = "Hello, world!\n";
+
+const char *const script_texts[] PROGMEM = {
+	text_greeting,
+};
+
+// SysReq+8: down a line three times, a tenth of a second apart
+static const uint8_t slow_down[] PROGMEM = {
+	S_REPEAT(3), S_TAP(KEY_DOWN), S_DELAY(100), S_NEXT,
+	S_END
+};
+
+// SysReq+9: type the greeting
+static const uint8_t greet[] PROGMEM = {
+	S_TYPE(0),
+	S_END
+};
+
+// by key, from 1; a sequence recorded for a key is played instead
+const uint8_t *const script_programs[NUM_SEQUENCES] PROGMEM = {
+	[7] = slow_down,
+	[8] = greet,
+};
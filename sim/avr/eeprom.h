@@ -0,0 +1,21 @@
+/* Host-side stand-in for <avr/eeprom.h>: the EEPROM is an array in sim.c,
+ * loaded from and saved to a file with -e.  Each byte written keeps the
+ * EEPROM busy for the 3.4ms the real one takes.
+ */
+
+#ifndef sim_avr_eeprom_h__
+#define sim_avr_eeprom_h__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define E2END	0x0FFF	// 4K, as on the AT90USB1286
+
+uint8_t eeprom_is_ready(void);
+uint8_t eeprom_read_byte(const uint8_t *addr);
+void eeprom_write_byte(uint8_t *addr, uint8_t value);
+void eeprom_update_byte(uint8_t *addr, uint8_t value);
+void eeprom_read_block(void *dst, const void *src, size_t n);
+void eeprom_update_block(const void *src, void *dst, size_t n);
+
+#endif
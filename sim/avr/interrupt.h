@@ -0,0 +1,20 @@
+/* Host-side stand-in for <avr/interrupt.h>.  Each vector becomes a plain
+ * function that sim.c calls when the matching virtual interrupt fires.
+ */
+
+#ifndef sim_avr_interrupt_h__
+#define sim_avr_interrupt_h__
+
+#include <avr/io.h>
+
+#define USB_GEN_vect	sim_usb_gen_vect
+#define USB_COM_vect	sim_usb_com_vect
+#define TIMER1_COMPA_vect	sim_timer1_compa_vect
+
+#define ISR(vector, ...) void vector(void)
+
+void sim_sei(void);
+#define sei()	sim_sei()
+#define cli()	(SREG &= 0x7F)
+
+#endif
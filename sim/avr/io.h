@@ -0,0 +1,89 @@
+/* Host-side stand-in for <avr/io.h>, used only by the simulator build.
+ *
+ * Plain registers are ordinary variables.  Registers whose value depends
+ * on the outside world (input pins, the USB endpoint FIFOs) are routed
+ * through accessor functions in sim.c, which also advance the virtual
+ * clock so that polling loops make progress.
+ */
+
+#ifndef sim_avr_io_h__
+#define sim_avr_io_h__
+
+#include <stdint.h>
+
+#ifndef __AVR_AT90USB1286__
+#define __AVR_AT90USB1286__
+#endif
+
+extern volatile uint8_t SREG;
+extern volatile uint8_t CLKPR;
+
+// GPIO
+extern volatile uint8_t DDRA, PORTA, DDRB, PORTB, DDRC, PORTC, DDRD, PORTD;
+extern volatile uint8_t DDRE, PORTE, DDRF, PORTF;
+uint8_t sim_read_pin(uint8_t port);
+#define PINA	(sim_read_pin('A'))
+#define PINB	(sim_read_pin('B'))
+#define PINC	(sim_read_pin('C'))
+#define PIND	(sim_read_pin('D'))
+#define PINE	(sim_read_pin('E'))
+#define PINF	(sim_read_pin('F'))
+
+// Timer 1
+extern volatile uint8_t TCCR1A, TCCR1B, TIMSK1, TIFR1;
+extern volatile uint16_t OCR1A;
+volatile uint16_t *sim_tcnt1(void);
+#define TCNT1	(*sim_tcnt1())
+
+// USB device controller
+extern volatile uint8_t UHWCON, USBCON, UDCON, UDIEN, UDINT, UDADDR;
+extern volatile uint8_t UDFNUML, UDFNUMH, UENUM, UERST;
+volatile uint8_t *sim_pllcsr(void);
+volatile uint8_t *sim_ep_reg(uint8_t reg);
+volatile uint8_t *sim_uedatx(void);
+#define SIM_UECONX	0
+#define SIM_UECFG0X	1
+#define SIM_UECFG1X	2
+#define SIM_UEIENX	3
+#define SIM_UEINTX	4
+#define SIM_EP_REGS	5
+#define PLLCSR	(*sim_pllcsr())
+#define UECONX	(*sim_ep_reg(SIM_UECONX))
+#define UECFG0X	(*sim_ep_reg(SIM_UECFG0X))
+#define UECFG1X	(*sim_ep_reg(SIM_UECFG1X))
+#define UEIENX	(*sim_ep_reg(SIM_UEIENX))
+#define UEINTX	(*sim_ep_reg(SIM_UEINTX))
+#define UEDATX	(*sim_uedatx())
+
+// register bits, as in the AT90USB1286 datasheet
+#define CS10		0
+#define CS11		1
+#define CS12		2
+#define WGM12		3
+#define OCIE1A		1
+#define OCF1A		1
+#define PLOCK		0
+#define USBE		7
+#define FRZCLK		5
+#define OTGPADE		4
+#define DETACH		0
+#define EORSTE		3
+#define SOFE		2
+#define EORSTI		3
+#define SOFI		2
+#define ADDEN		7
+#define STALLRQ		5
+#define STALLRQC	4
+#define RSTDT		3
+#define EPEN		0
+#define FIFOCON		7
+#define NAKINI		6
+#define RWAL		5
+#define NAKOUTI		4
+#define RXSTPI		3
+#define RXOUTI		2
+#define STALLEDI	1
+#define TXINI		0
+#define RXSTPE		3
+
+#endif
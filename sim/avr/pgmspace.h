@@ -0,0 +1,14 @@
+/* Host-side stand-in for <avr/pgmspace.h>: flash is ordinary memory. */
+
+#ifndef sim_avr_pgmspace_h__
+#define sim_avr_pgmspace_h__
+
+#include <stdint.h>
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_word(addr) (*(const uint16_t *)(addr))
+#define pgm_read_ptr(addr) (*(void * const *)(addr))
+
+#endif
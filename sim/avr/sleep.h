@@ -0,0 +1,17 @@
+/* Host-side stand-in for <avr/sleep.h>: sleeping runs the virtual clock
+ * until the next interrupt has been serviced.
+ */
+
+#ifndef sim_avr_sleep_h__
+#define sim_avr_sleep_h__
+
+#define SLEEP_MODE_IDLE	0
+
+void sim_sleep(void);
+#define set_sleep_mode(mode)
+#define sleep_enable()
+#define sleep_disable()
+#define sleep_cpu()	sim_sleep()
+#define sleep_mode()	sim_sleep()
+
+#endif
@@ -0,0 +1,1194 @@
+/* Host-native simulator for the 286keyboard firmware.
+ * Copyright (c) 2013 W. Owen Parry
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* The firmware sources are compiled unchanged
+ * against the stand-in headers in this directory.  This file supplies the
+ * hardware behind them:
+ *
+ *   - a virtual clock, advanced by _delay_us(), by sleeping and by every
+ *     access to a simulated register, which drives timer 1, start-of-frame
+ *     interrupts and the script;
+ *   - a 13x8 switch matrix without diodes, wired to ports C, F, D and B
+ *     exactly as on the real board (so it ghosts like the real board);
+ *     a released row keeps its closed columns low until it has floated
+ *     back up, which takes up to -s microseconds (rows further down the
+ *     scan are slower), and so does its pin with the pull-up on;
+ *   - an EEPROM, kept in a file with -e;
+ *   - a USB device controller and a host that enumerates the keyboard,
+ *     polls every IN endpoint once per frame and records what it receives
+ *     (boot and NKRO keyboard reports both update the same key state).
+ *
+ * Scripts are plain text, one command per line, '#' starts a comment:
+ *
+ *   wait <n>[us|ms]     advance the script clock (default unit ms)
+ *   press <key>         close a switch; <key> is a KEYS() name or row:col
+ *   release <key>       open a switch
+ *   tap <key>           press, wait 30ms, release, wait 30ms
+ *   bounce <key> <n> [<t>us]
+ *                       chatter: the switch changes state n times, t apart
+ *                       (default 250us), and the script clock moves on n*t
+ *   expect <key>...     check the keys the host currently sees as held;
+ *                       "expect none" checks that nothing is held
+ *   never <key>...      from here on, check that no report holds all of
+ *                       these keys at once; "never" alone stops checking
+ *   stall <n>[us|ms]    the host stops polling for this long, as a busy
+ *                       host or a slow hub may; the script clock stays put
+ *   protocol boot|report
+ *                       the host selects the keyboard protocol, as a BIOS
+ *                       (boot) or an operating system (report) does
+ *   reset               the host resets the bus and configures the
+ *                       keyboard again, as when an operating system takes
+ *                       over from the BIOS
+ *   reports [<n>]       check that n keyboard reports arrived since the
+ *                       last "reports" line; without n, just start counting
+ *
+ * Script time starts when the firmware first samples the matrix after
+ * the host has configured it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/eeprom.h>
+#include "layout.h"
+#include "debug_event.h"
+
+#define CYCLES_PER_US	(F_CPU / 1000000)
+#define CYCLES_PER_MS	(F_CPU / 1000)
+#define TAP_MS		30
+#define BOUNCE_US	250	// default time between edges of a bounce
+#define TAIL_MS		50
+#define EEPROM_WRITE_US	3400	// per byte
+
+// must match the endpoint numbers in usb_keyboard_debug.c
+#define SIM_NKRO_EP	1
+#define SIM_KEYBOARD_EP	3
+#define SIM_DEBUG_EP	4
+#define SIM_KEYBOARD_IF	0	// the boot interface
+
+int firmware_main(void);
+void sim_usb_gen_vect(void);
+void sim_usb_com_vect(void);
+void sim_timer1_compa_vect(void);
+
+static void tick(uint64_t cycles);
+
+
+/**************************************************************************
+ *
+ *  Registers
+ *
+ **************************************************************************/
+
+volatile uint8_t SREG, CLKPR;
+volatile uint8_t DDRA, PORTA, DDRB, PORTB, DDRC, PORTC, DDRD, PORTD;
+volatile uint8_t DDRE, PORTE, DDRF, PORTF;
+volatile uint8_t UHWCON, USBCON, UDCON, UDIEN, UDINT, UDADDR;
+volatile uint8_t UDFNUML, UDFNUMH, UENUM, UERST;
+volatile uint8_t TCCR1A, TCCR1B, TIMSK1, TIFR1;
+volatile uint16_t OCR1A;
+
+
+/**************************************************************************
+ *
+ *  Options and statistics
+ *
+ **************************************************************************/
+
+static int quiet = 0;		// -q: summary only
+static int show_debug = 0;	// -d: echo the debug channel
+static int read_debug = 1;	// -n: nobody reads the debug channel
+static FILE *raw_debug = NULL;	// -r: save the debug channel as received
+static uint32_t poll_phase_us = 100;	// -p: host IN token offset after SOF
+static uint32_t jitter_us = 0;		// -j: spread key events over this long
+static uint32_t rise_us = 4;		// -s: slowest row float up time
+static const char *eeprom_file = NULL;	// -e: EEPROM contents, kept here
+
+static uint64_t now = 0;	// cycles since power on
+static int armed = 0;		// script clock running
+static uint64_t script_start;
+static int failures = 0;
+
+static uint32_t row_samples = 0;	// column reads with exactly one row driven
+static uint32_t probe_samples = 0;	// column reads with several rows driven
+static uint32_t reports = 0;
+static uint32_t latency_count = 0;
+static uint64_t latency_sum = 0, latency_max = 0;
+
+static double ms(uint64_t cycles)
+{
+	return (double)cycles / CYCLES_PER_MS;
+}
+
+static double script_ms(void)
+{
+	return armed ? ms(now - script_start) : 0.0;
+}
+
+
+/**************************************************************************
+ *
+ *  Switch matrix
+ *
+ **************************************************************************/
+
+static const char row_port[NUM_ROWS] = ROW_PORT;
+static const uint8_t row_pin[NUM_ROWS] = ROW_PIN;
+static const char column_port[NUM_COLUMNS] = COLUMN_PORT;
+static const uint8_t column_pin[NUM_COLUMNS] = COLUMN_PIN;
+static const char *key_names[NUM_ROWS][NUM_COLUMNS] = { KEYS(NAME) };
+static const uint8_t key_codes[NUM_ROWS][NUM_COLUMNS] = { KEYS(CODE) };
+static const uint8_t modifier_bits[NUM_MODIFIER_KEYS] = MODIFIER_CODES;
+
+// keys only a keymap layer sends (keymap.c), for "expect" and for naming
+// what the host sees
+#define USAGE(k) { #k, KEY_##k },
+#define KEYPAD(k) { "KEYPAD_" #k, KEYPAD_##k },
+static const struct { const char *name; uint8_t code; } layer_keys[] = {
+	USAGE(F11) USAGE(F12) USAGE(MOD_GUI)
+	KEYPAD(0) KEYPAD(1) KEYPAD(2) KEYPAD(3) KEYPAD(4) KEYPAD(5) KEYPAD(6)
+	KEYPAD(7) KEYPAD(8) KEYPAD(9) KEYPAD(PERIOD) KEYPAD(SLASH)
+	KEYPAD(ASTERIX) KEYPAD(MINUS) KEYPAD(PLUS) KEYPAD(ENTER)
+};
+#define NUM_LAYER_KEYS (sizeof(layer_keys) / sizeof(layer_keys[0]))
+
+static uint8_t pressed[NUM_ROWS];	// closed switches, one bit per column
+static uint16_t rows_driven = 0;	// as of the last register access
+static uint64_t released_at[NUM_ROWS];
+
+static volatile uint8_t *ddr_reg(char port)
+{
+	switch (port) {
+	case 'A': return &DDRA;
+	case 'B': return &DDRB;
+	case 'C': return &DDRC;
+	case 'D': return &DDRD;
+	case 'E': return &DDRE;
+	}
+	return &DDRF;
+}
+
+static volatile uint8_t *port_reg(char port)
+{
+	switch (port) {
+	case 'A': return &PORTA;
+	case 'B': return &PORTB;
+	case 'C': return &PORTC;
+	case 'D': return &PORTD;
+	case 'E': return &PORTE;
+	}
+	return &PORTF;
+}
+
+static int row_driven(uint8_t row)
+{
+	uint8_t bit = 1 << row_pin[row];
+
+	return (*ddr_reg(row_port[row]) & bit) && !(*port_reg(row_port[row]) & bit);
+}
+
+static uint64_t rise_cycles(uint8_t row)
+{
+	return (uint64_t)rise_us * CYCLES_PER_US * (NUM_ROWS + row) / (2 * NUM_ROWS);
+}
+
+// driven, or released and not yet floated back up
+static int row_low(uint8_t row)
+{
+	return row_driven(row) || now - released_at[row] < rise_cycles(row);
+}
+
+// note when rows are released; called on every register access
+static void sync_rows(void)
+{
+	uint16_t driven = 0;
+	uint8_t r;
+
+	for (r=0; r<NUM_ROWS; r++) {
+		if (row_driven(r)) driven |= 1<<r;
+		else if (rows_driven & (1<<r)) released_at[r] = now;
+	}
+	rows_driven = driven;
+}
+
+
+// Columns pulled low by the driven rows.  There are no diodes, so current
+// also flows backwards through any closed switch: follow every path.
+static uint8_t active_columns(uint8_t *num_driven)
+{
+	uint16_t rows = 0, reached;
+	uint8_t cols = 0, prev;
+	uint8_t r, n = 0;
+
+	for (r=0; r<NUM_ROWS; r++) {
+		if (row_driven(r)) n++;
+		if (row_low(r)) rows |= 1<<r;
+	}
+	*num_driven = n;
+	do {
+		prev = cols;
+		reached = rows;
+		for (r=0; r<NUM_ROWS; r++) {
+			if (rows & (1<<r)) cols |= pressed[r];
+		}
+		for (r=0; r<NUM_ROWS; r++) {
+			if (pressed[r] & cols) rows |= 1<<r;
+		}
+	} while (cols != prev || rows != reached);
+	return cols;
+}
+
+static void start_script(void);
+
+// Inputs read high through their pull-ups, or floating, unless a column
+// is pulled low by a driven row, or a row is driven low or still floating
+// back up.  Outputs read as driven.
+uint8_t sim_read_pin(uint8_t port)
+{
+	uint8_t cols = 0, v = 0xFF, n, i;
+	volatile uint8_t *ddr = ddr_reg(port);
+
+	tick(1);
+	if (memchr(column_port, port, NUM_COLUMNS)) {
+		// the first column's port is read once a sample
+		if (port == column_port[0] && !armed) start_script();
+		cols = active_columns(&n);
+		if (port == column_port[0] && armed) {
+			if (n == 1) row_samples++;
+			else if (n > 1) probe_samples++;
+		}
+	}
+	for (i=0; i<NUM_COLUMNS; i++) {
+		if (column_port[i] == port && (cols & (1<<i))) v &= ~(1 << column_pin[i]);
+	}
+	for (i=0; i<NUM_ROWS; i++) {
+		if (row_port[i] == port && row_low(i)) v &= ~(1 << row_pin[i]);
+	}
+	return (v & ~*ddr) | (*port_reg(port) & *ddr);
+}
+
+
+/**************************************************************************
+ *
+ *  EEPROM
+ *
+ **************************************************************************/
+
+static uint8_t eeprom[E2END + 1];
+static uint32_t eeprom_writes = 0;
+static uint64_t eeprom_busy_until = 0;	// a write started takes 3.4ms
+
+static void load_eeprom(void)
+{
+	FILE *f;
+
+	memset(eeprom, 0xFF, sizeof(eeprom));	// erased
+	if (!eeprom_file || !(f = fopen(eeprom_file, "rb"))) return;
+	if (fread(eeprom, 1, sizeof(eeprom), f) != sizeof(eeprom)) {
+		memset(eeprom, 0xFF, sizeof(eeprom));
+	}
+	fclose(f);
+}
+
+static void save_eeprom(void)
+{
+	FILE *f;
+
+	if (!eeprom_file) return;
+	if (!(f = fopen(eeprom_file, "wb"))) {
+		perror(eeprom_file);
+		return;
+	}
+	fwrite(eeprom, 1, sizeof(eeprom), f);
+	fclose(f);
+}
+
+// as in avr-libc, reads and writes first wait for a write under way
+static void eeprom_wait(void)
+{
+	if (now < eeprom_busy_until) tick(eeprom_busy_until - now);
+}
+
+uint8_t eeprom_is_ready(void)
+{
+	return now >= eeprom_busy_until;
+}
+
+uint8_t eeprom_read_byte(const uint8_t *addr)
+{
+	eeprom_wait();
+	tick(4);
+	return eeprom[(uintptr_t)addr & E2END];
+}
+
+void eeprom_write_byte(uint8_t *addr, uint8_t value)
+{
+	eeprom_wait();
+	eeprom[(uintptr_t)addr & E2END] = value;
+	eeprom_writes++;
+	eeprom_busy_until = now + EEPROM_WRITE_US * CYCLES_PER_US;
+}
+
+void eeprom_update_byte(uint8_t *addr, uint8_t value)
+{
+	if (eeprom_read_byte(addr) != value) eeprom_write_byte(addr, value);
+}
+
+void eeprom_read_block(void *dst, const void *src, size_t n)
+{
+	size_t i;
+
+	for (i=0; i<n; i++) {
+		((uint8_t *)dst)[i] = eeprom_read_byte((const uint8_t *)src + i);
+	}
+}
+
+void eeprom_update_block(const void *src, void *dst, size_t n)
+{
+	size_t i;
+
+	for (i=0; i<n; i++) {
+		eeprom_update_byte((uint8_t *)dst + i, ((const uint8_t *)src)[i]);
+	}
+}
+
+
+/**************************************************************************
+ *
+ *  Timer 1, normal (free-running) mode only
+ *
+ **************************************************************************/
+
+static uint64_t t1_base;	// when the count was last zero
+static int t1_running = 0;
+static uint16_t tcnt1;
+static uint16_t tcnt1_handed;
+static int pending_t1 = 0;
+
+static uint16_t t1_prescale(void)
+{
+	static const uint16_t prescale[8] = { 0, 1, 8, 64, 256, 1024, 0, 0 };
+
+	return prescale[TCCR1B & 7];
+}
+
+static uint16_t t1_count(void)
+{
+	return t1_running ? (now - t1_base) / t1_prescale() : 0;
+}
+
+// cycle of the next compare A interrupt, or 0 if none is due
+static uint64_t t1_next(void)
+{
+	uint64_t count;
+
+	if (!t1_prescale()) {
+		t1_running = 0;
+		return 0;
+	}
+	if (!t1_running) {
+		t1_running = 1;
+		t1_base = now;
+	}
+	if (!(TIMSK1 & (1<<OCIE1A))) return 0;
+	count = (now - t1_base) / t1_prescale();
+	count += (uint16_t)(OCR1A - (uint16_t)count - 1) + 1;
+	return t1_base + count * t1_prescale();
+}
+
+static void t1_compare(void)
+{
+	pending_t1 = 1;
+}
+
+volatile uint16_t *sim_tcnt1(void)
+{
+	tick(1);
+	tcnt1 = tcnt1_handed = t1_count();
+	return &tcnt1;
+}
+
+
+/**************************************************************************
+ *
+ *  USB device controller
+ *
+ **************************************************************************/
+
+#define NUM_EP 7
+
+static struct {
+	uint8_t reg[SIM_EP_REGS];	// value returned by the last access
+	uint8_t shadow[SIM_EP_REGS];	// value the firmware may have written
+	uint8_t fill;			// bytes written to the current bank
+	uint8_t head, queued;		// banks committed, waiting for the host
+	uint8_t data[2][64];
+	uint8_t len[2];
+	uint64_t committed_at[2];
+} ep[NUM_EP];
+
+static uint8_t setup[8], setup_len, setup_pos;
+static uint8_t scratch;
+static uint8_t pllcsr;
+static int enumerated = 0;
+static int in_isr = 0;
+static int pending_gen = 0;
+static uint32_t isr_runs = 0, isr_runs_at_sei = 0;
+
+static uint8_t ep_size(uint8_t n)
+{
+	return 8 << ((ep[n].reg[SIM_UECFG1X] >> 4) & 3);
+}
+
+static uint8_t ep_banks(uint8_t n)
+{
+	return (ep[n].reg[SIM_UECFG1X] & 0x04) ? 2 : 1;
+}
+
+static int ep_free(uint8_t n)
+{
+	return (ep[n].reg[SIM_UECONX] & (1<<EPEN)) && ep[n].queued < ep_banks(n);
+}
+
+static uint8_t ueintx(uint8_t n)
+{
+	uint8_t v = 0;
+
+	if (n == 0) {
+		v = (1<<TXINI);
+		if (setup_pos < setup_len) v |= (1<<RXSTPI);
+		return v;
+	}
+	if (ep_free(n)) {
+		v |= (1<<FIFOCON) | (1<<TXINI);
+		if (ep[n].fill < ep_size(n)) v |= (1<<RWAL);
+	}
+	return v;
+}
+
+// Registers are handed out by pointer, so a write only becomes visible
+// on the next access; apply whatever the firmware stored since then.
+static void sync(void)
+{
+	uint8_t n, r, v, bank;
+
+	if (tcnt1 != tcnt1_handed) {
+		t1_next();
+		t1_base = now - (uint64_t)tcnt1 * t1_prescale();
+		tcnt1_handed = tcnt1;
+	}
+	sync_rows();
+
+	for (n=0; n<NUM_EP; n++) {
+		for (r=0; r<SIM_EP_REGS; r++) {
+			v = ep[n].shadow[r];
+			if (v == ep[n].reg[r]) continue;
+			ep[n].reg[r] = v;
+			if (r != SIM_UEINTX) continue;
+			if (n == 0) {
+				if (!(v & (1<<RXSTPI))) setup_len = setup_pos = 0;
+			} else if (!(v & (1<<FIFOCON)) && ep_free(n)) {
+				bank = (ep[n].head + ep[n].queued) & 1;
+				ep[n].len[bank] = ep[n].fill;
+				ep[n].committed_at[bank] = now;
+				ep[n].queued++;
+				ep[n].fill = 0;
+			}
+		}
+	}
+}
+
+volatile uint8_t *sim_pllcsr(void)
+{
+	pllcsr |= (1<<PLOCK);
+	return &pllcsr;
+}
+
+volatile uint8_t *sim_ep_reg(uint8_t r)
+{
+	uint8_t n;
+
+	sync();
+	tick(1);
+	n = UENUM % NUM_EP;
+	if (r == SIM_UEINTX) ep[n].reg[r] = ueintx(n);
+	ep[n].shadow[r] = ep[n].reg[r];
+	return &ep[n].shadow[r];
+}
+
+volatile uint8_t *sim_uedatx(void)
+{
+	uint8_t n, bank;
+
+	sync();
+	tick(1);
+	n = UENUM % NUM_EP;
+	if (n == 0) {
+		if (setup_pos < setup_len) return &setup[setup_pos++];
+		return &scratch;
+	}
+	if (!ep_free(n) || ep[n].fill >= ep_size(n)) return &scratch;
+	bank = (ep[n].head + ep[n].queued) & 1;
+	return &ep[n].data[bank][ep[n].fill++];
+}
+
+static void run_isr(void (*isr)(void))
+{
+	uint8_t sreg = SREG;
+
+	isr_runs++;
+	in_isr = 1;
+	SREG &= 0x7F;
+	isr();
+	sync();
+	SREG = sreg;
+	in_isr = 0;
+}
+
+static void dispatch(void)
+{
+	if (in_isr || !(SREG & 0x80)) return;
+	// in vector order, which is also the hardware priority
+	while (pending_gen || pending_t1) {
+		if (pending_gen) {
+			pending_gen = 0;
+			run_isr(sim_usb_gen_vect);
+		} else {
+			pending_t1 = 0;
+			run_isr(sim_timer1_compa_vect);
+		}
+	}
+}
+
+static void control_request(uint8_t bmRequestType, uint8_t bRequest,
+	uint16_t wValue, uint16_t wIndex)
+{
+	setup[0] = bmRequestType;
+	setup[1] = bRequest;
+	setup[2] = wValue;
+	setup[3] = wValue >> 8;
+	setup[4] = wIndex;
+	setup[5] = wIndex >> 8;
+	setup[6] = setup[7] = 0;
+	setup_pos = 0;
+	setup_len = 8;
+	run_isr(sim_usb_com_vect);
+	setup_len = setup_pos = 0;
+}
+
+// The host resets the bus and selects configuration 1.
+static void bus_reset(void)
+{
+	UDINT |= (1<<EORSTI);
+	run_isr(sim_usb_gen_vect);
+	control_request(0x00, 9, 1, 0);		// SET_CONFIGURATION
+}
+
+// as it does once it notices the attach
+static void enumerate(void)
+{
+	enumerated = 1;
+	tick(20 * CYCLES_PER_MS);
+	bus_reset();
+}
+
+void sim_sei(void)
+{
+	isr_runs_at_sei = isr_runs;
+	SREG |= 0x80;
+	if (!enumerated && (USBCON & (1<<USBE)) && !(UDCON & (1<<DETACH))
+	  && (UDIEN & (1<<EORSTE))) {
+		enumerate();
+	}
+	dispatch();
+}
+
+
+/**************************************************************************
+ *
+ *  USB host
+ *
+ **************************************************************************/
+
+#define KEY_BYTES 32
+#define KEY_SET(keys, code) ((keys)[(code) >> 3] |= 1 << ((code) & 7))
+#define KEY_IS_SET(keys, code) ((keys)[(code) >> 3] & (1 << ((code) & 7)))
+
+static uint8_t host_modifiers;
+static uint8_t host_keys[KEY_BYTES];	// one bit per usage
+
+#define MAX_PENDING 64
+static uint64_t pending_changes[MAX_PENDING];	// matrix changes not yet reported
+static uint8_t num_pending = 0;
+
+static const char *code_name(uint8_t code)
+{
+	static char buf[8];
+	uint8_t r, c;
+
+	for (r=0; r<NUM_ROWS; r++) {
+		for (c=0; c<NUM_COLUMNS; c++) {
+			if (key_codes[r][c] == code) return key_names[r][c];
+		}
+	}
+	for (r=0; r<NUM_LAYER_KEYS; r++) {
+		if (layer_keys[r].code == code) return layer_keys[r].name;
+	}
+	snprintf(buf, sizeof(buf), "0x%02X", code);
+	return buf;
+}
+
+static void print_host_state(FILE *f)
+{
+	unsigned i, any = 0;
+
+	for (i=0; i<NUM_MODIFIER_KEYS; i++) {
+		if (host_modifiers & modifier_bits[i]) {
+			fprintf(f, " %s", code_name(KEY_MODIFIER_BIT | i));
+			any = 1;
+		}
+	}
+	for (i=0; i<KEY_BYTES * 8; i++) {
+		if (KEY_IS_SET(host_keys, i)) {
+			fprintf(f, " %s", code_name(i));
+			any = 1;
+		}
+	}
+	if (!any) fprintf(f, " none");
+}
+
+static void check_never(void);
+
+static void receive_keyboard(const uint8_t *data, uint8_t len, uint64_t committed_at, int boot)
+{
+	uint64_t latency, worst = 0;
+	uint8_t i, j;
+
+	reports++;
+	host_modifiers = data[0];
+	if (boot) {
+		// modifiers, reserved, then up to 6 keys; a host ignores the keys
+		// of a report that signals ErrorRollOver
+		for (i=2; i<len && data[i] != KEY_ERROR_ROLLOVER; i++) ;
+		if (i == len) {
+			memset(host_keys, 0, sizeof(host_keys));
+			for (i=2; i<len; i++) {
+				if (data[i]) KEY_SET(host_keys, data[i]);
+			}
+		}
+	} else {
+		// modifiers, then a bit per usage
+		memset(host_keys, 0, sizeof(host_keys));
+		for (i=1; i<len && i <= KEY_BYTES; i++) {
+			host_keys[i-1] = data[i];
+		}
+	}
+	for (i=0, j=0; i<num_pending; i++) {
+		if (pending_changes[i] >= committed_at) {
+			pending_changes[j++] = pending_changes[i];
+			continue;
+		}
+		latency = now - pending_changes[i];
+		latency_sum += latency;
+		latency_count++;
+		if (latency > latency_max) latency_max = latency;
+		if (latency > worst) worst = latency;
+	}
+	num_pending = j;
+	check_never();
+	if (quiet) return;
+	printf("%10.3f ms  keyboard ", script_ms());
+	for (i=0; i<len; i++) printf(" %02X", data[i]);
+	printf("  ");
+	print_host_state(stdout);
+	if (worst) printf("  (latency %.3f ms)", ms(worst));
+	printf("\n");
+}
+
+static void receive_debug(const uint8_t *data, uint8_t len)
+{
+	static char line[256];
+	static uint8_t used = 0;
+	static uint8_t event[EVENT_BYTES], have = 0;
+	uint8_t i;
+
+	if (raw_debug) fwrite(data, 1, len, raw_debug);
+	if (!show_debug) return;
+	for (i=0; i<len; i++) {
+		if (EVENT_IS_HEADER(data[i]) || (have && (data[i] & 0x80))) {
+			if (EVENT_IS_HEADER(data[i])) have = 0;
+			event[have++] = data[i];
+			if (have < EVENT_BYTES) continue;
+			have = 0;
+			printf("%10.3f ms  debug     %s %s row:%02X col:%02X frame:%u\n", script_ms(),
+				EVENT_TYPE(event) == EVENT_KEYDOWN ? "keydown" : "keyup  ",
+				EVENT_ROW(event) < NUM_ROWS ? key_names[EVENT_ROW(event)][EVENT_COL(event)] : "?",
+				EVENT_ROW(event), EVENT_COL(event), EVENT_FRAME(event));
+			continue;
+		}
+		have = 0;
+		if (data[i] == 0 || data[i] == '\r') continue;
+		if (data[i] != '\n' && used < sizeof(line) - 1) {
+			line[used++] = data[i];
+			continue;
+		}
+		line[used] = 0;
+		printf("%10.3f ms  debug     %s\n", script_ms(), line);
+		used = 0;
+	}
+}
+
+static uint64_t stalled_until = 0;
+
+static void host_poll(void)
+{
+	uint8_t n, bank;
+
+	if (now < stalled_until) return;
+
+	for (n=1; n<NUM_EP; n++) {
+		if (!ep[n].queued) continue;
+		if (n == SIM_DEBUG_EP && !read_debug) continue;
+		bank = ep[n].head;
+		ep[n].head ^= 1;
+		ep[n].queued--;
+		if (n == SIM_KEYBOARD_EP || n == SIM_NKRO_EP) {
+			receive_keyboard(ep[n].data[bank], ep[n].len[bank], ep[n].committed_at[bank],
+				n == SIM_KEYBOARD_EP);
+		} else if (n == SIM_DEBUG_EP) {
+			receive_debug(ep[n].data[bank], ep[n].len[bank]);
+		}
+	}
+}
+
+static void start_of_frame(void)
+{
+	uint16_t frame = ((UDFNUMH << 8) | UDFNUML) + 1;
+
+	UDFNUML = frame;
+	UDFNUMH = (frame >> 8) & 0x07;
+	if (UDIEN & (1<<SOFE)) {
+		UDINT |= (1<<SOFI);
+		pending_gen = 1;
+	}
+}
+
+
+/**************************************************************************
+ *
+ *  Script
+ *
+ **************************************************************************/
+
+enum { EV_PRESS, EV_RELEASE, EV_TOGGLE, EV_EXPECT, EV_NEVER, EV_REPORTS, EV_PROTOCOL, EV_RESET, EV_STALL };
+
+struct event {
+	uint64_t at;		// cycles after script start
+	uint8_t type;
+	uint8_t row, col;
+	uint8_t change;		// counts towards latency
+	uint32_t reports;	// EV_REPORTS: reports since the last one
+	uint8_t modifiers;	// EV_EXPECT, EV_NEVER: host state to check
+	uint8_t keys[KEY_BYTES];
+	uint8_t protocol;	// EV_PROTOCOL: 0 boot, 1 report
+	uint64_t stall;		// EV_STALL: cycles without polling
+	int line;
+};
+
+static struct event *events;
+static int num_events = 0, next_event = 0;
+static uint64_t script_length = 0;
+
+// Moving each key event by a different fraction of a frame keeps them
+// from all landing at the same point in the scan; use a fixed sequence
+// so that runs are repeatable.
+static uint64_t jitter(void)
+{
+	static uint32_t seed = 1;
+
+	if (!jitter_us) return 0;
+	seed = seed * 1103515245 + 12345;
+	return (uint64_t)((seed >> 8) % jitter_us) * CYCLES_PER_US;
+}
+
+static struct event *add_event(uint8_t type, uint64_t at, int line)
+{
+	struct event *e;
+
+	events = realloc(events, (num_events + 1) * sizeof(*events));
+	if (!events) {
+		perror("realloc");
+		exit(2);
+	}
+	e = &events[num_events++];
+	memset(e, 0, sizeof(*e));
+	e->type = type;
+	e->at = at;
+	e->line = line;
+	return e;
+}
+
+static int find_key(const char *name, uint8_t *row, uint8_t *col)
+{
+	unsigned r, c;
+
+	if (sscanf(name, "%u:%u", &r, &c) == 2 && r < NUM_ROWS && c < NUM_COLUMNS) {
+		*row = r;
+		*col = c;
+		return 1;
+	}
+	for (r=0; r<NUM_ROWS; r++) {
+		for (c=0; c<NUM_COLUMNS; c++) {
+			if (strcmp(key_names[r][c], "NONE") == 0) continue;
+			if (strcmp(key_names[r][c], name) == 0) {
+				*row = r;
+				*col = c;
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
+
+static void script_error(const char *file, int line, const char *msg, const char *arg)
+{
+	fprintf(stderr, "%s:%d: %s%s%s\n", file, line, msg, arg ? " " : "", arg ? arg : "");
+	exit(2);
+}
+
+static void load_script(const char *file)
+{
+	char buf[256], *cmd, *arg, *end;
+	uint64_t t = 0;
+	uint8_t row, col, code;
+	uint64_t shift, interval;
+	unsigned edges;
+	double amount;
+	struct event *e, tmp;
+	int line = 0, i, j;
+	FILE *f;
+
+	f = fopen(file, "r");
+	if (!f) {
+		perror(file);
+		exit(2);
+	}
+	while (fgets(buf, sizeof(buf), f)) {
+		line++;
+		if ((end = strchr(buf, '#'))) *end = 0;
+		cmd = strtok(buf, " \t\r\n");
+		if (!cmd) continue;
+		arg = strtok(NULL, " \t\r\n");
+		if (strcmp(cmd, "wait") == 0 || strcmp(cmd, "stall") == 0) {
+			if (!arg) script_error(file, line, "needs a time", NULL);
+			amount = strtod(arg, &end);
+			if (strcmp(end, "us") == 0) amount *= CYCLES_PER_US;
+			else if (*end == 0 || strcmp(end, "ms") == 0) amount *= CYCLES_PER_MS;
+			else script_error(file, line, "bad time", arg);
+			if (cmd[0] == 'w') {
+				t += amount;
+			} else {
+				e = add_event(EV_STALL, t, line);
+				e->stall = amount;
+			}
+		} else if (strcmp(cmd, "press") == 0 || strcmp(cmd, "release") == 0
+		  || strcmp(cmd, "tap") == 0) {
+			if (!arg || !find_key(arg, &row, &col)) script_error(file, line, "unknown key", arg);
+			if (cmd[0] != 'r') {
+				e = add_event(EV_PRESS, t + jitter(), line);
+				e->row = row;
+				e->col = col;
+				e->change = 1;
+			}
+			if (cmd[0] == 't') t += TAP_MS * CYCLES_PER_MS;
+			if (cmd[0] != 'p') {
+				e = add_event(EV_RELEASE, t + jitter(), line);
+				e->row = row;
+				e->col = col;
+				e->change = 1;
+			}
+			if (cmd[0] == 't') t += TAP_MS * CYCLES_PER_MS;
+		} else if (strcmp(cmd, "bounce") == 0) {
+			// the switch changes state this many times, interval apart
+			if (!arg || !find_key(arg, &row, &col)) script_error(file, line, "unknown key", arg);
+			arg = strtok(NULL, " \t\r\n");
+			if (!arg || sscanf(arg, "%u", &edges) != 1) script_error(file, line, "bounce needs a count", NULL);
+			interval = BOUNCE_US * CYCLES_PER_US;
+			if ((arg = strtok(NULL, " \t\r\n"))) {
+				amount = strtod(arg, &end);
+				if (strcmp(end, "us") != 0) script_error(file, line, "bad time", arg);
+				interval = amount * CYCLES_PER_US;
+			}
+			shift = jitter();
+			for (i=0; i<(int)edges; i++, t += interval) {
+				e = add_event(EV_TOGGLE, t + shift, line);
+				e->row = row;
+				e->col = col;
+				// latency runs from the first edge, if the key ends up changed
+				e->change = i == 0 && (edges & 1);
+			}
+		} else if (strcmp(cmd, "reports") == 0) {
+			e = add_event(EV_REPORTS, t, line);
+			e->reports = (uint32_t)-1;
+			if (arg && sscanf(arg, "%u", &e->reports) != 1) script_error(file, line, "bad count", arg);
+		} else if (strcmp(cmd, "protocol") == 0) {
+			e = add_event(EV_PROTOCOL, t, line);
+			if (arg && strcmp(arg, "boot") == 0) e->protocol = 0;
+			else if (arg && strcmp(arg, "report") == 0) e->protocol = 1;
+			else script_error(file, line, "protocol needs boot or report", arg);
+		} else if (strcmp(cmd, "reset") == 0) {
+			add_event(EV_RESET, t, line);
+		} else if (strcmp(cmd, "expect") == 0 || strcmp(cmd, "never") == 0) {
+			e = add_event(cmd[0] == 'e' ? EV_EXPECT : EV_NEVER, t, line);
+			for (; arg; arg = strtok(NULL, " \t\r\n")) {
+				if (strcmp(arg, "none") == 0) continue;
+				if (find_key(arg, &row, &col)) {
+					code = key_codes[row][col];
+				} else {
+					for (i=0; i<(int)NUM_LAYER_KEYS; i++) {
+						if (strcmp(layer_keys[i].name, arg) == 0) break;
+					}
+					if (i == (int)NUM_LAYER_KEYS) script_error(file, line, "unknown key", arg);
+					code = layer_keys[i].code;
+				}
+				if (code & KEY_MODIFIER_BIT) {
+					e->modifiers |= modifier_bits[code & KEY_MODIFIER_INDEX_MASK];
+				} else {
+					KEY_SET(e->keys, code);
+				}
+			}
+		} else {
+			script_error(file, line, "unknown command", cmd);
+		}
+	}
+	fclose(f);
+	script_length = t + jitter_us * CYCLES_PER_US;
+	// jittered events may now be out of order; keep equal times in order
+	for (i=1; i<num_events; i++) {
+		for (j=i; j>0 && events[j-1].at > events[j].at; j--) {
+			tmp = events[j];
+			events[j] = events[j-1];
+			events[j-1] = tmp;
+		}
+	}
+}
+
+// a report holding all the keys of the last "never" line fails it
+static const struct event *never = NULL;
+
+static void check_never(void)
+{
+	uint8_t i;
+
+	if (!never || (never->modifiers & ~host_modifiers)) return;
+	for (i=0; i<KEY_BYTES; i++) {
+		if (never->keys[i] & ~host_keys[i]) return;
+	}
+	for (i=0; i<KEY_BYTES && !never->keys[i]; i++) ;
+	if (i == KEY_BYTES && !never->modifiers) return;	// "never" alone
+	failures++;
+	printf("%10.3f ms  FAIL line %d: host sees", script_ms(), never->line);
+	print_host_state(stdout);
+	printf("\n");
+}
+
+static void check(const struct event *e)
+{
+	if (host_modifiers == e->modifiers && memcmp(host_keys, e->keys, KEY_BYTES) == 0) {
+		return;
+	}
+	failures++;
+	printf("%10.3f ms  FAIL line %d: host sees", script_ms(), e->line);
+	print_host_state(stdout);
+	printf("\n");
+}
+
+static void check_reports(const struct event *e)
+{
+	static uint32_t last = 0;
+
+	if (e->reports != (uint32_t)-1 && reports - last != e->reports) {
+		failures++;
+		printf("%10.3f ms  FAIL line %d: host got %u reports\n", script_ms(), e->line,
+			reports - last);
+	}
+	last = reports;
+}
+
+static void run_event(const struct event *e)
+{
+	switch (e->type) {
+	case EV_PRESS:
+		pressed[e->row] |= 1<<e->col;
+		break;
+	case EV_RELEASE:
+		pressed[e->row] &= ~(1<<e->col);
+		break;
+	case EV_TOGGLE:
+		pressed[e->row] ^= 1<<e->col;
+		break;
+	case EV_EXPECT:
+		check(e);
+		break;
+	case EV_NEVER:
+		never = e;
+		break;
+	case EV_REPORTS:
+		check_reports(e);
+		break;
+	case EV_STALL:
+		stalled_until = now + e->stall;
+		break;
+	case EV_PROTOCOL:
+		control_request(0x21, 11, e->protocol, SIM_KEYBOARD_IF);	// SET_PROTOCOL
+		break;
+	case EV_RESET:
+		bus_reset();
+		break;
+	}
+	if (e->change && num_pending < MAX_PENDING) pending_changes[num_pending++] = now;
+}
+
+static void start_script(void)
+{
+	if (!enumerated) return;
+	armed = 1;
+	script_start = now;
+}
+
+static void finish(void)
+{
+	double seconds = ms(now - script_start) / 1000.0;
+	double passes = (double)row_samples / NUM_ROWS;
+
+	printf("sim: %.1f ms simulated, %u row samples, %u probes (%.0f matrix passes/s)\n",
+		seconds * 1000.0, row_samples, probe_samples,
+		seconds > 0 ? passes / seconds : 0.0);
+	printf("sim: %u keyboard reports, latency avg %.3f ms max %.3f ms\n",
+		reports, latency_count ? ms(latency_sum) / latency_count : 0.0,
+		ms(latency_max));
+	if (eeprom_writes) printf("sim: %u EEPROM bytes written\n", eeprom_writes);
+	printf("sim: %d expect failure%s\n", failures, failures == 1 ? "" : "s");
+	save_eeprom();
+	exit(failures ? 1 : 0);
+}
+
+
+/**************************************************************************
+ *
+ *  Virtual clock
+ *
+ **************************************************************************/
+
+static uint64_t next_sof = CYCLES_PER_MS;
+static uint64_t next_poll;
+
+static void tick(uint64_t cycles)
+{
+	uint64_t target = now + cycles;
+	uint64_t next, t1;
+
+	sync();
+	while (1) {
+		next = next_sof < next_poll ? next_sof : next_poll;
+		t1 = t1_next();
+		if (t1 && t1 < next) next = t1;
+		if (armed && next_event < num_events && script_start + events[next_event].at < next) {
+			next = script_start + events[next_event].at;
+		}
+		if (armed && script_start + script_length + TAIL_MS * CYCLES_PER_MS < next) {
+			next = script_start + script_length + TAIL_MS * CYCLES_PER_MS;
+		}
+		if (next > target) break;
+		if (next > now) now = next;
+		if (next == t1) {
+			t1_compare();
+		} else if (next == next_sof) {
+			next_sof += CYCLES_PER_MS;
+			start_of_frame();
+		} else if (next == next_poll) {
+			next_poll += CYCLES_PER_MS;
+			if (enumerated) host_poll();
+		} else if (next_event < num_events && script_start + events[next_event].at == next) {
+			run_event(&events[next_event++]);
+		} else {
+			finish();
+		}
+		dispatch();
+	}
+	if (now < target) now = target;
+	dispatch();
+}
+
+void sim_delay_us(double us)
+{
+	tick(us * CYCLES_PER_US);
+}
+
+// An interrupt taken by the sei() just before sleep_cpu() would have
+// woken the CPU straight away, so only wait if none was.
+void sim_sleep(void)
+{
+	uint32_t runs = isr_runs;
+
+	if (isr_runs != isr_runs_at_sei) return;
+	while (isr_runs == runs) tick(CYCLES_PER_US);
+}
+
+
+int main(int argc, char **argv)
+{
+	const char *script = NULL;
+	int i;
+
+	for (i=1; i<argc; i++) {
+		if (strcmp(argv[i], "-q") == 0) quiet = 1;
+		else if (strcmp(argv[i], "-d") == 0) show_debug = 1;
+		else if (strcmp(argv[i], "-n") == 0) read_debug = 0;
+		else if (strcmp(argv[i], "-r") == 0 && i+1 < argc) {
+			raw_debug = fopen(argv[++i], "wb");
+			if (!raw_debug) {
+				perror(argv[i]);
+				return 2;
+			}
+		}
+		else if (strcmp(argv[i], "-p") == 0 && i+1 < argc) poll_phase_us = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-j") == 0 && i+1 < argc) jitter_us = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-s") == 0 && i+1 < argc) rise_us = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-e") == 0 && i+1 < argc) eeprom_file = argv[++i];
+		else if (!script) script = argv[i];
+		else script = NULL, i = argc;
+	}
+	if (!script || poll_phase_us >= 1000) {
+		fprintf(stderr, "usage: %s [-q] [-d] [-n] [-r raw_debug_file] [-p poll_phase_us] [-j jitter_us] [-s rise_us] [-e eeprom_file] script\n", argv[0]);
+		return 2;
+	}
+	load_script(script);
+	load_eeprom();
+	// the host polls once per frame, poll_phase_us after SOF
+	next_poll = CYCLES_PER_MS + poll_phase_us * CYCLES_PER_US;
+	firmware_main();
+	return 0;
+}
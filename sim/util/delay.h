@@ -0,0 +1,10 @@
+/* Host-side stand-in for <util/delay.h>: delays advance the virtual clock. */
+
+#ifndef sim_util_delay_h__
+#define sim_util_delay_h__
+
+void sim_delay_us(double us);
+#define _delay_us(us)	sim_delay_us(us)
+#define _delay_ms(ms)	sim_delay_us((ms) * 1000.0)
+
+#endif
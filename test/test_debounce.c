@@ -0,0 +1,217 @@
+/* Host tests for debounce.c: synthetic bounce waveforms on every key.
+ * Built once per algorithm and sample count by "make test".
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "debounce.h"
+
+#define N DEBOUNCE_SAMPLES
+#define MAX_WAVE 256
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { \
+	if (!(cond)) { \
+		printf("%s:%d: ", __FILE__, __LINE__); \
+		printf(__VA_ARGS__); \
+		printf("\n"); \
+		failures++; \
+	} \
+} while (0)
+
+// The algorithm one key at a time, as plainly as possible.
+typedef struct {
+	uint8_t state, count;
+} ref_key;
+
+static uint8_t ref_sample(ref_key *k, uint8_t raw)
+{
+#ifdef DEBOUNCE_EAGER
+	if (k->count) {
+		k->count--;
+	} else if (raw != k->state) {
+		k->state = raw;
+		k->count = N - 1;
+	}
+#else
+	if (raw == k->state) {
+		k->count = 0;
+	} else if (k->count == N - 1) {
+		k->state = raw;
+		k->count = 0;
+	} else {
+		k->count++;
+	}
+#endif
+	return k->state;
+}
+
+// Feed a waveform of '0'/'1' samples to one key; out gets the debounced one.
+static void run(const char *wave, char *out, uint8_t row, uint8_t col)
+{
+	uint8_t cols;
+
+	debounce_reset();
+	for (; *wave; wave++, out++) {
+		cols = debounce(row, *wave == '1' ? (1<<col) : 0);
+		*out = (cols & (1<<col)) ? '1' : '0';
+		CHECK(!(cols & ~(1<<col)), "row %d col %d leaked into 0x%02x", row, col, cols);
+	}
+	*out = 0;
+}
+
+static int edges(const char *s)
+{
+	int n = 0;
+	char prev = '0';
+
+	for (; *s; s++) {
+		n += *s != prev;
+		prev = *s;
+	}
+	return n;
+}
+
+static int first(const char *s, char c)
+{
+	int i;
+
+	for (i=0; s[i]; i++) {
+		if (s[i] == c) return i;
+	}
+	return -1;
+}
+
+static void append(char *s, int *len, char c, int count)
+{
+	while (count-- > 0 && *len < MAX_WAVE - 1) s[(*len)++] = c;
+	s[*len] = 0;
+}
+
+// A clean press and release.
+static void test_clean(void)
+{
+	char wave[MAX_WAVE], out[MAX_WAVE];
+	int len = 0;
+
+	append(wave, &len, '0', 3);
+	append(wave, &len, '1', 2*N + 2);
+	append(wave, &len, '0', 2*N + 2);
+	run(wave, out, 0, 0);
+	CHECK(edges(out) == 2, "clean: %s -> %s", wave, out);
+#ifdef DEBOUNCE_EAGER
+	CHECK(first(out, '1') == 3, "clean press late: %s", out);
+#else
+	CHECK(first(out, '1') == 3 + N - 1, "clean press at wrong time: %s", out);
+#endif
+}
+
+// Presses and releases that chatter for less than N samples give one
+// keystroke each.
+static void test_bounce(void)
+{
+	char wave[MAX_WAVE], out[MAX_WAVE];
+	int trial, len, bounce, press;
+
+	for (trial=0; trial<1000; trial++) {
+		len = 0;
+		append(wave, &len, '0', rand() % 4);
+		press = len;
+		bounce = rand() % N;	// samples from first to last edge
+		append(wave, &len, '1', 1);
+		while (bounce-- > 0) append(wave, &len, rand() & 1 ? '1' : '0', 1);
+		append(wave, &len, '1', N + rand() % 4);
+		bounce = rand() % N;
+		append(wave, &len, '0', 1);
+		while (bounce-- > 0) append(wave, &len, rand() & 1 ? '1' : '0', 1);
+		append(wave, &len, '0', N + rand() % 4);
+		run(wave, out, rand() % NUM_ROWS, rand() % NUM_COLUMNS);
+		CHECK(edges(out) == 2, "bounce: %s -> %s", wave, out);
+#ifdef DEBOUNCE_EAGER
+		CHECK(first(out, '1') == press, "bounce press late: %s -> %s", wave, out);
+#else
+		CHECK(first(out, '1') >= press + N - 1, "bounce press early: %s -> %s", wave, out);
+#endif
+	}
+}
+
+// A one sample spike is filtered out, or with the eager algorithm released
+// again once the lockout expires.
+static void test_glitch(void)
+{
+	char wave[MAX_WAVE], out[MAX_WAVE];
+	int len = 0;
+
+	append(wave, &len, '0', 2);
+	append(wave, &len, '1', 1);
+	append(wave, &len, '0', 2*N + 2);
+	run(wave, out, 1, 7);
+	if (N == 1) {
+		CHECK(edges(out) == 2, "glitch: %s -> %s", wave, out);
+		return;
+	}
+#ifdef DEBOUNCE_EAGER
+	CHECK(edges(out) == 2 && first(out, '1') == 2 && out[2 + N] == '0' && out[1 + N] == '1',
+		"glitch: %s -> %s", wave, out);
+#else
+	CHECK(edges(out) == 0, "glitch: %s -> %s", wave, out);
+#endif
+}
+
+// Every key of the matrix at once, each with its own random chatter, against
+// the one key at a time version.
+static void test_matrix(void)
+{
+	static ref_key ref[NUM_ROWS][NUM_COLUMNS];
+	uint8_t raw[NUM_ROWS][NUM_COLUMNS];
+	uint8_t row, col, cols, expect;
+	int t;
+
+	debounce_reset();
+	for (row=0; row<NUM_ROWS; row++) {
+		for (col=0; col<NUM_COLUMNS; col++) {
+			ref[row][col].state = ref[row][col].count = 0;
+			raw[row][col] = 0;
+		}
+	}
+	for (t=0; t<20000; t++) {
+		for (row=0; row<NUM_ROWS; row++) {
+			cols = 0;
+			for (col=0; col<NUM_COLUMNS; col++) {
+				// mostly steady, sometimes chattering
+				if (rand() % (t & 256 ? 4 : 40) == 0) raw[row][col] ^= 1;
+				cols |= raw[row][col] << col;
+			}
+			cols = debounce(row, cols);
+			expect = 0;
+			for (col=0; col<NUM_COLUMNS; col++) {
+				expect |= ref_sample(&ref[row][col], raw[row][col]) << col;
+			}
+			if (cols != expect) {
+				CHECK(0, "sample %d row %d: 0x%02x, expected 0x%02x", t, row, cols, expect);
+				return;
+			}
+			expect = 0;
+			for (col=0; col<NUM_COLUMNS; col++) {
+				expect |= (ref[row][col].count != 0) << col;
+			}
+			CHECK(debounce_pending(row) == expect, "sample %d row %d pending 0x%02x, expected 0x%02x",
+				t, row, debounce_pending(row), expect);
+		}
+	}
+}
+
+int main(void)
+{
+	srand(286);
+	test_clean();
+	test_bounce();
+	test_glitch();
+	test_matrix();
+	if (failures) {
+		printf("%d failures\n", failures);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,69 @@
+/* Round trip of the binary debug events through tools/debug_decode:
+ *
+ *   test_debug_event > events.bin     every frame number, row, column and
+ *                                     type, among text and zero padding
+ *   debug_decode events.bin | test_debug_event -c
+ *                                     check each came back, in order
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "debug_event.h"
+
+#define NUM_EVENTS 2048		// frame numbers are 11 bits
+#define MAX_ROW 64		// and rows 6
+
+// the event of each frame number, covering every row and column
+#define ROW(f)	((f) % MAX_ROW)
+#define COL(f)	(((f) / MAX_ROW) % 8)
+#define TYPE(f)	(((f) / (MAX_ROW * 8)) & 1)
+
+static void write_events(void)
+{
+	unsigned f;
+
+	for (f=0; f<NUM_EVENTS; f++) {
+		putchar(EVENT_HEADER(TYPE(f)));
+		putchar(EVENT_ROW_BYTE(ROW(f)));
+		putchar(EVENT_COL_BYTE(COL(f)));
+		putchar(EVENT_FRAME_LO(f));
+		putchar(EVENT_FRAME_HI(f));
+		// text, and the padding of a packet only partly filled
+		if (f % 61 == 0) printf("text\n");
+		if (f % 67 == 0) putchar(0);
+	}
+}
+
+static int check_events(void)
+{
+	char line[256], type[16];
+	unsigned f = 0, row, col, frame;
+	int failures = 0;
+
+	while (fgets(line, sizeof(line), stdin)) {
+		if (strcmp(line, "text\n") == 0) continue;
+		if (sscanf(line, "%15s %*s row:%x col:%x frame:%u", type, &row, &col, &frame) != 4
+		  || strcmp(type, TYPE(f) == EVENT_KEYDOWN ? "keydown" : "keyup") != 0
+		  || row != ROW(f) || col != COL(f) || frame != f) {
+			if (failures++ < 20) printf("event %u: %s", f, line);
+			if (sscanf(line, "%*s %*s row:%*x col:%*x frame:%u", &frame) == 1) f = frame;
+		}
+		f++;
+	}
+	if (f != NUM_EVENTS) {
+		printf("%u events, want %u\n", f, NUM_EVENTS);
+		failures++;
+	}
+	if (failures) {
+		printf("%d failures\n", failures);
+		return 1;
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc == 2 && strcmp(argv[1], "-c") == 0) return check_events();
+	write_events();
+	return 0;
+}
@@ -0,0 +1,228 @@
+/* Host tests for ghost.c: every pair and triple of keys in KEYS(), read
+ * through a model of the diode-less matrix.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "ghost.h"
+
+#define REAL(k) (KEY_##k != KEY_NONE)
+static const uint8_t real_keys[NUM_ROWS][NUM_COLUMNS] = { KEYS(REAL) };
+
+static int failures = 0;
+
+typedef struct {
+	uint8_t row, col;
+} pos;
+
+static pos all_keys[NUM_ROWS * NUM_COLUMNS];
+static const uint8_t settled[NUM_ROWS];	// no debouncing under way
+static int num_keys = 0;
+
+// What the scanner reads with these switches closed: a row reads a column
+// closed when some path of closed switches connects them.
+static void read_matrix(const pos *pressed, int n, uint8_t *cols)
+{
+	uint8_t parent[NUM_ROWS + NUM_COLUMNS];
+	uint8_t r, c, a, b;
+	int i;
+
+	for (i=0; i<NUM_ROWS + NUM_COLUMNS; i++) parent[i] = i;
+	for (i=0; i<n; i++) {
+		for (a=pressed[i].row; parent[a] != a; a = parent[a]) ;
+		for (b=NUM_ROWS + pressed[i].col; parent[b] != b; b = parent[b]) ;
+		parent[a] = b;
+	}
+	for (r=0; r<NUM_ROWS; r++) {
+		cols[r] = 0;
+		for (c=0; c<NUM_COLUMNS; c++) {
+			for (a=r; parent[a] != a; a = parent[a]) ;
+			for (b=NUM_ROWS + c; parent[b] != b; b = parent[b]) ;
+			if (a == b) cols[r] |= 1<<c;
+		}
+	}
+}
+
+static void set_keys(uint8_t *keys, const pos *p, int n)
+{
+	memset(keys, 0, NUM_ROWS);
+	while (n-- > 0) keys[p[n].row] |= 1<<p[n].col;
+}
+
+static void print_keys(const char *what, const uint8_t *keys)
+{
+	uint8_t r, c;
+
+	printf(" %s", what);
+	for (r=0; r<NUM_ROWS; r++) {
+		for (c=0; c<NUM_COLUMNS; c++) {
+			if (keys[r] & (1<<c)) printf(" %d:%d", r, c);
+		}
+	}
+}
+
+// Press (or release, if n is smaller than last time) to leave these keys
+// closed, run one pass and compare what is reported.
+static void step(const char *what, const pos *pressed, int n, uint8_t *keys,
+	const pos *expect, int num_expect)
+{
+	uint8_t cols[NUM_ROWS], want[NUM_ROWS];
+	int i;
+
+	read_matrix(pressed, n, cols);
+	ghost_filter(cols, settled, keys);
+	set_keys(want, expect, num_expect);
+	if (memcmp(keys, want, NUM_ROWS) == 0) return;
+	if (failures++ < 20) {
+		printf("%s:", what);
+		for (i=0; i<n; i++) printf(" %d:%d", pressed[i].row, pressed[i].col);
+		print_keys("got", keys);
+		print_keys("want", want);
+		printf("\n");
+	}
+}
+
+// Any two keys are told apart, in either order.
+static void test_pairs(void)
+{
+	uint8_t keys[NUM_ROWS];
+	pos p[2];
+	int a, b;
+
+	for (a=0; a<num_keys; a++) {
+		for (b=0; b<num_keys; b++) {
+			if (a == b) continue;
+			p[0] = all_keys[a];
+			p[1] = all_keys[b];
+			memset(keys, 0, sizeof(keys));
+			step("pair press", p, 1, keys, p, 1);
+			step("pair press", p, 2, keys, p, 2);
+			step("pair release", p, 1, keys, p, 1);
+			step("pair together", p, 2, keys, p, 2);
+		}
+	}
+}
+
+// Three keys on the corners of a rectangle make a ghost at the fourth, if
+// that has a switch: the third key cannot be told from the ghost, so
+// neither is reported until one of the first two is released.
+static void test_triples(void)
+{
+	uint8_t keys[NUM_ROWS];
+	pos p[3], q[2];
+	int a, b, c, ghost;
+
+	for (a=0; a<num_keys; a++) {
+		for (b=a+1; b<num_keys; b++) {
+			for (c=b+1; c<num_keys; c++) {
+				p[0] = all_keys[a];
+				p[1] = all_keys[b];
+				p[2] = all_keys[c];
+				// two rows and two columns between them: an L
+				ghost = (p[0].row == p[1].row || p[0].row == p[2].row || p[1].row == p[2].row)
+				     && (p[0].col == p[1].col || p[0].col == p[2].col || p[1].col == p[2].col)
+				     && !(p[0].row == p[1].row && p[1].row == p[2].row)
+				     && !(p[0].col == p[1].col && p[1].col == p[2].col);
+				if (ghost) {
+					uint8_t r = p[0].row ^ p[1].row ^ p[2].row;
+					uint8_t k = p[0].col ^ p[1].col ^ p[2].col;
+					ghost = real_keys[r][k];
+				}
+				memset(keys, 0, sizeof(keys));
+				step("triple press", p, 1, keys, p, 1);
+				step("triple press", p, 2, keys, p, 2);
+				step("triple press", p, 3, keys, p, ghost ? 2 : 3);
+				// releasing the second breaks any rectangle
+				q[0] = p[0];
+				q[1] = p[2];
+				step("triple release", q, 2, keys, q, 2);
+				memset(keys, 0, sizeof(keys));
+				step("triple together", p, 3, keys, p, ghost ? 0 : 3);
+			}
+		}
+	}
+}
+
+// Eager debouncing holds a ghost closed for a while after its rectangle
+// breaks; it is not taken for a key meanwhile.
+static void test_lockout(void)
+{
+	// Q and W on row 4, O under Q on row 5, and P under W the ghost
+	static const pos q_w_o[] = { { 4, 2 }, { 4, 1 }, { 5, 2 } };
+	static const pos q_o[] = { { 4, 2 }, { 5, 2 } };
+	uint8_t cols[NUM_ROWS], pending[NUM_ROWS], keys[NUM_ROWS], want[NUM_ROWS];
+
+	set_keys(keys, q_w_o, 2);
+	memset(pending, 0, sizeof(pending));
+	pending[5] = 0x06;	// O and P, just closed
+	read_matrix(q_w_o, 3, cols);
+	ghost_filter(cols, pending, keys);
+	read_matrix(q_o, 2, cols);
+	cols[5] |= 0x02;	// and W just released: P held by its lockout
+	ghost_filter(cols, pending, keys);
+	set_keys(want, q_o, 1);
+	if (memcmp(keys, want, NUM_ROWS) != 0 && failures++ < 20) {
+		print_keys("lockout: got", keys);
+		printf("\n");
+	}
+	// the lockout over, P reads open and O is no longer in doubt
+	read_matrix(q_o, 2, cols);
+	pending[5] = 0;
+	ghost_filter(cols, pending, keys);
+	set_keys(want, q_o, 2);
+	if (memcmp(keys, want, NUM_ROWS) != 0 && failures++ < 20) {
+		print_keys("lockout over: got", keys);
+		printf("\n");
+	}
+}
+
+// Rolling over keys on the home row and around it is never blocked.
+static void test_rollover(void)
+{
+	uint8_t keys[NUM_ROWS];
+	pos p[5];
+	int i, n = 0;
+	uint8_t r, c;
+	const uint8_t codes[] = { KEY_A, KEY_S, KEY_D, KEY_F, KEY_J };
+	static const uint8_t code_matrix[NUM_ROWS][NUM_COLUMNS] = { KEYS(CODE) };
+
+	for (i=0; i<5; i++) {
+		for (r=0; r<NUM_ROWS; r++) {
+			for (c=0; c<NUM_COLUMNS; c++) {
+				if (code_matrix[r][c] == codes[i]) {
+					p[n].row = r;
+					p[n++].col = c;
+				}
+			}
+		}
+	}
+	if (n != 5) {
+		printf("rollover: keys missing from KEYS()\n");
+		failures++;
+		return;
+	}
+	memset(keys, 0, sizeof(keys));
+	for (i=1; i<=5; i++) step("rollover", p, i, keys, p, i);
+}
+
+int main(void)
+{
+	uint8_t r, c;
+
+	for (r=0; r<NUM_ROWS; r++) {
+		for (c=0; c<NUM_COLUMNS; c++) {
+			if (!real_keys[r][c]) continue;
+			all_keys[num_keys].row = r;
+			all_keys[num_keys++].col = c;
+		}
+	}
+	test_pairs();
+	test_triples();
+	test_lockout();
+	test_rollover();
+	if (failures) {
+		printf("%d failures\n", failures);
+		return 1;
+	}
+	return 0;
+}
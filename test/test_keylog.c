@@ -0,0 +1,136 @@
+/* Host tests for keylog.c: reports replayed from the log match the ones
+ * logged, however many the ring has had to forget.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "keylog.h"
+
+#define MAX_REPORTS 20000
+
+static int failures = 0;
+static keys_state logged[MAX_REPORTS];
+static int num_logged = 0;
+static uint32_t seed = 1;
+
+static uint8_t random_byte(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return seed >> 16;
+}
+
+static void fail(const char *what, int n)
+{
+	if (failures++ < 20) printf("%s: report %d\n", what, n);
+}
+
+// Log a report, remembering it if it changed anything.
+static void add(const keys_state *s)
+{
+	if (num_logged && memcmp(s, &logged[num_logged - 1], sizeof(*s)) == 0) {
+		keylog_add(s);
+		return;
+	}
+	keylog_add(s);
+	logged[num_logged++] = *s;
+}
+
+// The log replays the last keylog_count reports added, in order.
+static void check(const char *what, int at_least)
+{
+	struct keylog_cursor c;
+	int n;
+
+	if (keylog_count < at_least) {
+		printf("%s: only %u reports kept, want %d\n", what, keylog_count, at_least);
+		failures++;
+	}
+	if (keylog_count > num_logged) {
+		fail(what, keylog_count);
+		return;
+	}
+	n = num_logged - keylog_count;
+	keylog_start(&c);
+	while (keylog_next(&c)) {
+		if (n >= num_logged) {
+			fail(what, n);
+			return;
+		}
+		if (memcmp(&c.state, &logged[n], sizeof(c.state)) != 0) fail(what, n);
+		n++;
+	}
+	if (n != num_logged) fail(what, n);
+}
+
+static void reset(const keys_state *s)
+{
+	keylog_reset(s);
+	num_logged = 0;
+	logged[num_logged] = *s;	// what the next report is compared with
+}
+
+// Typing: each report presses or releases a single key or modifier, and
+// takes a byte.
+static void test_typing(void)
+{
+	keys_state s;
+	uint8_t code;
+	int i;
+
+	memset(&s, 0, sizeof(s));
+	reset(&s);
+	for (i=0; i<5000; i++) {
+		code = 4 + random_byte() % (KEYBOARD_MAX_USAGE - 3);
+		s.keyboard_keys[code >> 3] |= 1 << (code & 7);
+		add(&s);
+		if (i % 7 == 0) {
+			s.keyboard_modifier_keys ^= 1 << (random_byte() & 7);
+			add(&s);
+		}
+		s.keyboard_keys[code >> 3] &= ~(1 << (code & 7));
+		add(&s);
+		add(&s);	// repeated, not logged
+	}
+	check("typing", KEYLOG_SIZE - 1);
+}
+
+// Chords and random states, including every key at once.
+static void test_chords(void)
+{
+	keys_state s;
+	int n;
+
+	memset(&s, 0, sizeof(s));
+	s.keyboard_keys[0] = 0x30;	// held since before the log was reset
+	reset(&s);
+	for (n=0; n<3000; n++) {
+		switch (random_byte() & 3) {
+		case 0:
+			memset(&s, 0, sizeof(s));
+			break;
+		case 1:
+			memset(&s, 0xFF, sizeof(s));
+			s.keyboard_keys[0] &= ~0x0F;	// usages 0-3 are not keys
+			break;
+		default:
+			s.keyboard_keys[random_byte() % KEYBOARD_KEYS_SIZE] ^= random_byte();
+			s.keyboard_keys[0] &= ~0x0F;
+			s.keyboard_modifier_keys ^= random_byte();
+			break;
+		}
+		add(&s);
+		if (n == 5) check("chords, before wrapping", num_logged);
+	}
+	check("chords", KEYLOG_SIZE / (8 + 8 * KEYBOARD_KEYS_SIZE));
+}
+
+int main(void)
+{
+	test_typing();
+	test_chords();
+	if (failures) {
+		printf("%d failures\n", failures);
+		return 1;
+	}
+	return 0;
+}
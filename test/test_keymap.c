@@ -0,0 +1,103 @@
+/* Host tests for keymap.c: Fn and the keypad lock give the keys they
+ * should, and a key lets go of what it pressed whatever the layers did
+ * meanwhile.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "keymap.h"
+
+// switches by their names in layout.txt, found through KEYS()
+static const char *names[NUM_ROWS][NUM_COLUMNS] = { KEYS(NAME) };
+#define FN		"SCROLL_LOCK"
+#define NUM_LOCK	"NUM_LOCK"
+#define F9		"F9"
+#define ALT		"MOD_ALT"
+#define J		"J"
+#define A		"A"
+#define PRINTSCREEN	"PRINTSCREEN"
+
+static int failures = 0;
+
+static void check(const char *what, uint8_t got, uint8_t want)
+{
+	if (got != want && failures++ < 20) {
+		printf("%s: got %u, want %u\n", what, got, want);
+	}
+}
+
+// the row and column of the switch called name
+static void find(const char *name, uint8_t *row, uint8_t *col)
+{
+	for (*row=0; *row<NUM_ROWS; (*row)++) {
+		for (*col=0; *col<NUM_COLUMNS; (*col)++) {
+			if (strcmp(names[*row][*col], name) == 0) return;
+		}
+	}
+	printf("no switch %s in layout.txt\n", name);
+	failures++;
+	*row = *col = 0;
+}
+
+static uint8_t press(const char *name)
+{
+	uint8_t row, col;
+
+	find(name, &row, &col);
+	return keymap_press(row, col);
+}
+
+static uint8_t release(const char *name)
+{
+	uint8_t row, col;
+
+	find(name, &row, &col);
+	return keymap_release(row, col);
+}
+
+int main(void)
+{
+	check("F9", press(F9), KEY_F9);
+	check("F9 up", release(F9), KEY_F9);
+
+	check("Fn", press(FN), KEY_NONE);
+	check("Fn F9", press(F9), KEY_F11);
+	check("Fn Alt", press(ALT), KEY_MOD_GUI);
+	check("Fn PrtSc", press(PRINTSCREEN), KEY_SCROLL_LOCK);
+	check("Fn A", press(A), KEY_A);
+	check("Fn up", release(FN), KEY_NONE);
+	// pressed under Fn, so let go as that
+	check("F9 up after Fn", release(F9), KEY_F11);
+	check("Alt up after Fn", release(ALT), KEY_MOD_GUI);
+	check("PrtSc up after Fn", release(PRINTSCREEN), KEY_SCROLL_LOCK);
+	check("A up after Fn", release(A), KEY_A);
+	check("PrtSc", press(PRINTSCREEN), KEY_PRINTSCREEN);
+	check("PrtSc up", release(PRINTSCREEN), KEY_PRINTSCREEN);
+
+	// J held from before the keypad goes on
+	check("J", press(J), KEY_J);
+	press(FN);
+	check("Fn Num Lock", press(NUM_LOCK), KEY_NONE);
+	check("Fn Num Lock up", release(NUM_LOCK), KEY_NONE);
+	release(FN);
+	check("J up on keypad", release(J), KEY_J);
+	check("keypad J", press(J), KEYPAD_1);
+	check("keypad A", press(A), KEY_A);
+	// Fn over the keypad: its own keys, the keypad's, then the base's
+	press(FN);
+	check("Fn keypad F9", press(F9), KEY_F11);
+	check("Fn keypad Num Lock", press(NUM_LOCK), KEY_NONE);
+	release(NUM_LOCK);
+	release(FN);
+	check("J up off keypad", release(J), KEYPAD_1);
+	check("A up off keypad", release(A), KEY_A);
+	check("F9 up off keypad", release(F9), KEY_F11);
+	check("J off keypad", press(J), KEY_J);
+	check("J up", release(J), KEY_J);
+
+	if (failures) {
+		printf("%d failures\n", failures);
+		return 1;
+	}
+	return 0;
+}
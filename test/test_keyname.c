@@ -0,0 +1,44 @@
+/* Host tests for keyname.c: every switch and every key of layout.txt finds
+ * its own name in the packed pool.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "keyname.h"
+
+static const char *names[NUM_ROWS][NUM_COLUMNS] = { KEYS(NAME) };
+static const uint8_t codes[NUM_ROWS][NUM_COLUMNS] = { KEYS(CODE) };
+
+static int failures = 0;
+
+static void check(const char *what, const char *got, const char *want)
+{
+	if ((!got || !want ? got != want : strcmp(got, want) != 0) && failures++ < 20) {
+		printf("%s: got %s, want %s\n", what, got ? got : "none", want ? want : "none");
+	}
+}
+
+int main(void)
+{
+	uint8_t r, c;
+
+	for (r=0; r<NUM_ROWS; r++) {
+		for (c=0; c<NUM_COLUMNS; c++) {
+			check("at", keyname_at(r, c), names[r][c]);
+			if (codes[r][c] == KEY_NONE) continue;
+			check("of", keyname_of(codes[r][c]), names[r][c]);
+		}
+	}
+	check("of NONE", keyname_of(KEY_NONE), "NONE");
+	check("of a layer key", keyname_of(KEY_F11), 0);
+	// the pool is as long as the header says
+	if (sizeof(KEY_NAME_POOL) != KEY_NAME_POOL_SIZE) {
+		printf("pool: %u bytes, not %u\n", (unsigned)sizeof(KEY_NAME_POOL), KEY_NAME_POOL_SIZE);
+		failures++;
+	}
+	if (failures) {
+		printf("%d failures\n", failures);
+		return 1;
+	}
+	return 0;
+}
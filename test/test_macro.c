@@ -0,0 +1,287 @@
+/* Host tests for macro.c: sequences saved to a model of the EEPROM load
+ * back after a restart, however often they are saved, with the writes
+ * spread over the ring, and a save cut short by a power loss leaves the
+ * sequence as it was.  One sequence may take the whole arena, and the
+ * time between reports is kept.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <avr/io.h>
+#include "macro.h"
+
+volatile uint8_t UDFNUML, UDFNUMH;
+static uint8_t eeprom[E2END + 1];
+static uint32_t writes[E2END + 1];
+
+uint8_t eeprom_is_ready(void)
+{
+	return 1;
+}
+
+uint8_t eeprom_read_byte(const uint8_t *addr)
+{
+	return eeprom[(uintptr_t)addr & E2END];
+}
+
+void eeprom_write_byte(uint8_t *addr, uint8_t value)
+{
+	eeprom[(uintptr_t)addr & E2END] = value;
+	writes[(uintptr_t)addr & E2END]++;
+}
+
+void eeprom_update_byte(uint8_t *addr, uint8_t value)
+{
+	if (eeprom_read_byte(addr) != value) eeprom_write_byte(addr, value);
+}
+
+void eeprom_read_block(void *dst, const void *src, size_t n)
+{
+	size_t i;
+
+	for (i=0; i<n; i++) {
+		((uint8_t *)dst)[i] = eeprom_read_byte((const uint8_t *)src + i);
+	}
+}
+
+void eeprom_update_block(const void *src, void *dst, size_t n)
+{
+	size_t i;
+
+	for (i=0; i<n; i++) {
+		eeprom_update_byte((uint8_t *)dst + i, ((const uint8_t *)src)[i]);
+	}
+}
+
+static int failures = 0;
+static keys_state expected[NUM_SEQUENCES][MACRO_ARENA_SIZE];
+static uint16_t expected_length[NUM_SEQUENCES];
+static uint32_t seed = 1;
+
+static uint8_t random_byte(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return seed >> 16;
+}
+
+// Record a sequence of up to length reports of typing, a few keys and
+// modifiers at a time, as far as the arena holds.
+static void record(uint8_t n, uint16_t length)
+{
+	keys_state s;
+	uint16_t i;
+	uint8_t code;
+
+	memset(&s, 0, sizeof(s));
+	macro_record(n);
+	expected_length[n] = 0;
+	for (i=0; i<length; i++) {
+		code = 4 + random_byte() % (KEYBOARD_MAX_USAGE - 3);
+		if (random_byte() & 1) s.keyboard_keys[code >> 3] ^= 1 << (code & 7);
+		if ((random_byte() & 7) == 0) s.keyboard_modifier_keys ^= random_byte();
+		if (!macro_add(&s)) break;
+		expected[n][expected_length[n]++] = s;
+	}
+	macro_stop();
+}
+
+static void save(void)
+{
+	while (macro_writing) macro_poll();
+}
+
+static void check_loaded(const char *what, int round)
+{
+	struct macro_cursor c;
+	uint16_t i;
+	uint8_t n;
+
+	for (n=0; n<NUM_SEQUENCES; n++) {
+		macro_start(n, &c);
+		for (i=0; i<expected_length[n] && macro_next(&c); i++) {
+			if (memcmp(&c.state, &expected[n][i], sizeof(keys_state))) break;
+		}
+		if (i != expected_length[n] || macro_next(&c)) {
+			if (failures++ < 20) {
+				printf("%s: round %d, sequence %u wrong\n", what, round, n);
+			}
+		}
+	}
+}
+
+static void check(const char *what, int round)
+{
+	check_loaded(what, round);
+	macro_load();
+	check_loaded(what, round);
+}
+
+// Save every sequence, then a few over and over, around the ring many
+// times; no byte may be written much more often than the average.
+static void test_wear(void)
+{
+	uint32_t total = 0, most = 0;
+	uint8_t n;
+	int i;
+
+	memset(eeprom, 0xFF, sizeof(eeprom));
+	memset(writes, 0, sizeof(writes));
+	macro_load();
+	check("empty", 0);
+	for (n=0; n<NUM_SEQUENCES; n++) {
+		record(n, random_byte() % 16);
+		save();
+	}
+	check("all", 0);
+	for (i=0; i<3000; i++) {
+		n = random_byte() % 3;
+		record(n, random_byte() % 16);
+		save();
+		if (i % 100 == 0) check("wear", i);
+	}
+	check("wear", i);
+	for (i=0; i<MACRO_EEPROM_ADDR; i++) {
+		if (writes[i]) {
+			printf("wear: matrix byte %d written\n", i);
+			failures++;
+		}
+	}
+	for (i=MACRO_EEPROM_ADDR; i<MACRO_EEPROM_END; i++) {
+		total += writes[i];
+		if (writes[i] > most) most = writes[i];
+	}
+	if (most > 2 * total / (MACRO_EEPROM_END - MACRO_EEPROM_ADDR) + 2) {
+		printf("wear: a byte written %u times, %u on average\n", most,
+			total / (MACRO_EEPROM_END - MACRO_EEPROM_ADDR));
+		failures++;
+	}
+}
+
+// Cut a save short after each number of bytes: the sequence loads as it
+// was, and the ring still works.
+static void test_power_loss(void)
+{
+	static keys_state old[MACRO_ARENA_SIZE];
+	uint16_t old_length;
+	uint8_t n = 5;
+	int bytes, i;
+
+	for (bytes=0; bytes<100; bytes++) {
+		memcpy(old, expected[n], sizeof(old));
+		old_length = expected_length[n];
+		record(n, 16);
+		for (i=0; i<bytes && macro_writing; i++) macro_poll();
+		if (!macro_writing) continue;	// the whole record was written
+		memcpy(expected[n], old, sizeof(old));
+		expected_length[n] = old_length;
+		macro_load();
+		check_loaded("power loss", bytes);
+	}
+}
+
+// Once the others are emptied one sequence may fill the arena, and adds
+// nothing more once it is full; recording another over closes the gap, even
+// while one is being saved.
+static void test_arena(void)
+{
+	uint8_t n, i;
+
+	for (n=0; n<NUM_SEQUENCES; n++) {
+		record(n, 0);
+		save();
+	}
+	record(7, 1000);
+	save();
+	if (expected_length[7] < MACRO_ARENA_SIZE / 4) {
+		printf("arena: %u reports kept\n", expected_length[7]);
+		failures++;
+	}
+	check("arena", 0);
+	record(7, 4);
+	record(2, 1000);
+	save();
+	check("arena", 1);
+	record(2, 10);
+	record(5, 30);
+	save();
+	check("arena", 2);
+	if (expected_length[2] != 10 || expected_length[5] != 30) {
+		printf("arena: %u and %u reports kept\n", expected_length[2],
+			expected_length[5]);
+		failures++;
+	}
+	// recording moves the bytes of a sequence being saved, or drops them
+	record(2, 20);
+	for (i=0; i<12; i++) macro_poll();
+	record(7, 6);
+	save();
+	check("arena", 3);
+	record(2, 20);
+	for (i=0; i<12; i++) macro_poll();
+	record(2, 8);
+	save();
+	check("arena", 4);
+}
+
+// the USB frame number moves on, as the main loop sees it once a frame
+static void frames(uint32_t n)
+{
+	uint16_t frame;
+
+	while (n--) {
+		frame = (((UDFNUMH << 8) | UDFNUML) + 1) & 0x7FF;
+		UDFNUML = frame;
+		UDFNUMH = frame >> 8;
+		macro_poll();
+	}
+}
+
+// The frames between reports come back, bar a gap of one frame, capped at
+// 2 bytes' worth, and survive a restart.
+static void test_gaps(void)
+{
+	static const uint32_t gaps[] = { 0, 1, 2, 127, 128, 3000, 20000, 5 };
+	static const uint16_t kept[] = { 0, 0, 2, 127, 128, 3000, 0x3FFF, 5 };
+	struct macro_cursor c;
+	keys_state s;
+	uint8_t i, n = 4, round;
+
+	memset(&s, 0, sizeof(s));
+	macro_record(n);
+	frames(40);
+	for (i=0; i<8; i++) {
+		s.keyboard_keys[0] ^= 0x10;
+		macro_add(&s);
+		if (i < 7) frames(gaps[i + 1]);
+	}
+	macro_stop();
+	save();
+	for (round=0; round<2; round++) {
+		macro_start(n, &c);
+		for (i=0; i<8; i++) {
+			if (!macro_next(&c) || c.delay != (i < 7 ? kept[i + 1] : 0)
+			  || c.state.keyboard_keys[0] != (i & 1 ? 0 : 0x10)) {
+				printf("gaps: round %u, report %u wrong\n", round, i);
+				failures++;
+			}
+		}
+		if (macro_next(&c)) {
+			printf("gaps: round %u, too many reports\n", round);
+			failures++;
+		}
+		macro_load();
+	}
+}
+
+int main(void)
+{
+	test_wear();
+	test_power_loss();
+	test_arena();
+	test_gaps();
+	if (failures) {
+		printf("%d failures\n", failures);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,124 @@
+/* Host tests for script.c: each op, typed text, delays and repeats give
+ * the reports they should, with this file's own scripts.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include "script.h"
+
+static const char text_mixed[] = "aB!\n";
+static const char text_untypeable[] = "\001a\002";
+static const char text_upper[] = "A";
+static const char text_empty[] = "";
+
+const char *const script_texts[] = {
+	text_mixed, text_untypeable, text_upper, text_empty,
+};
+
+static const uint8_t chord[] = {
+	S_PRESS(S_CTRL), S_TAP(KEY_C), S_RELEASE(S_CTRL), S_END
+};
+static const uint8_t typed[] = {
+	S_TYPE(0), S_DELAY(20), S_DELAY(5), S_TAP(KEY_X), S_END
+};
+static const uint8_t repeated[] = {
+	S_DELAY(7), S_REPEAT(3), S_TAP(KEY_DOWN), S_DELAY(100), S_NEXT, S_END
+};
+static const uint8_t skipped[] = {
+	S_TYPE(3), S_TYPE(1), S_DELAY(9), S_TYPE(3), S_END
+};
+static const uint8_t shifted[] = {
+	S_PRESS(S_SHIFT), S_TYPE(2), S_RELEASE(S_SHIFT), S_END
+};
+
+const uint8_t *const script_programs[NUM_SEQUENCES] = {
+	chord, typed, repeated, skipped, shifted,
+};
+
+static int failures = 0;
+
+static void fail(const char *what, int n)
+{
+	if (failures++ < 20) printf("%s: report %d wrong\n", what, n);
+}
+
+// The next report is the modifiers and keys given, 0 ended, and is
+// followed by delay frames.
+static void expect(const char *what, struct script_cursor *c, int n,
+	uint16_t delay, uint8_t modifiers, ...)
+{
+	keys_state s;
+	va_list keys;
+	int key;
+
+	memset(&s, 0, sizeof(s));
+	s.keyboard_modifier_keys = modifiers;
+	va_start(keys, modifiers);
+	while ((key = va_arg(keys, int))) s.keyboard_keys[key >> 3] |= 1 << (key & 7);
+	va_end(keys);
+	if (!script_next(c) || memcmp(&c->state, &s, sizeof(s)) || c->delay != delay) {
+		fail(what, n);
+	}
+}
+
+static void expect_end(const char *what, struct script_cursor *c, int n)
+{
+	if (script_next(c)) fail(what, n);
+}
+
+int main(void)
+{
+	struct script_cursor c;
+	int i;
+
+	script_start(0, &c);
+	expect("chord", &c, 0, 0, KEY_CTRL, 0);
+	expect("chord", &c, 1, 0, KEY_CTRL, KEY_C, 0);
+	expect("chord", &c, 2, 0, KEY_CTRL, 0);
+	expect("chord", &c, 3, 0, 0, 0);
+	expect_end("chord", &c, 4);
+
+	script_start(1, &c);
+	expect("typed", &c, 0, 0, 0, KEY_A, 0);
+	expect("typed", &c, 1, 0, 0, 0);
+	expect("typed", &c, 2, 0, KEY_SHIFT, KEY_B, 0);
+	expect("typed", &c, 3, 0, 0, 0);
+	expect("typed", &c, 4, 0, KEY_SHIFT, KEY_1, 0);
+	expect("typed", &c, 5, 0, 0, 0);
+	expect("typed", &c, 6, 0, 0, KEY_ENTER, 0);
+	expect("typed", &c, 7, 25, 0, 0);
+	expect("typed", &c, 8, 0, 0, KEY_X, 0);
+	expect("typed", &c, 9, 0, 0, 0);
+	expect_end("typed", &c, 10);
+
+	script_start(2, &c);
+	if (c.delay != 7) fail("repeated", -1);
+	for (i=0; i<3; i++) {
+		expect("repeated", &c, 2*i, 0, 0, KEY_DOWN, 0);
+		expect("repeated", &c, 2*i + 1, 100, 0, 0);
+	}
+	expect_end("repeated", &c, 6);
+
+	script_start(3, &c);
+	expect("skipped", &c, 0, 0, 0, KEY_A, 0);
+	expect("skipped", &c, 1, 9, 0, 0);
+	expect_end("skipped", &c, 2);
+
+	script_start(4, &c);
+	expect("shifted", &c, 0, 0, KEY_SHIFT, 0);
+	expect("shifted", &c, 1, 0, KEY_SHIFT, KEY_A, 0);
+	expect("shifted", &c, 2, 0, KEY_SHIFT, 0);
+	expect("shifted", &c, 3, 0, 0, 0);
+	expect_end("shifted", &c, 4);
+
+	if (script_defined(5)) fail("undefined", 0);
+	script_start(5, &c);
+	expect_end("undefined", &c, 0);
+
+	if (failures) {
+		printf("%d failures\n", failures);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,140 @@
+/* Debug channel listener and decoder for the 286keyboard firmware.
+ * Copyright (c) 2013 W. Owen Parry
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* Like hid_listen, but turns the binary key events of debug_event.h back
+ * into text, naming keys from the same KEYS() table as the firmware.
+ *
+ *   debug_decode            find the keyboard's debug interface among
+ *                           /dev/hidraw*, and wait for it if not plugged in
+ *   debug_decode <file>     decode a device or a saved stream ("-" = stdin)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <linux/hidraw.h>
+#include "layout.h"
+#include "debug_event.h"
+
+static const char *key_names[NUM_ROWS][NUM_COLUMNS] = { KEYS(NAME) };
+
+// the debug interface's report descriptor starts with
+// Usage Page 0xFF31, Usage 0x74
+static int is_debug_interface(int fd)
+{
+	struct hidraw_report_descriptor desc;
+	static const unsigned char usage[] = { 0x06, 0x31, 0xFF, 0x09, 0x74 };
+
+	if (ioctl(fd, HIDIOCGRDESCSIZE, &desc.size) < 0) return 0;
+	if (ioctl(fd, HIDIOCGRDESC, &desc) < 0) return 0;
+	return desc.size >= sizeof(usage) && memcmp(desc.value, usage, sizeof(usage)) == 0;
+}
+
+static int find_device(void)
+{
+	char path[32];
+	int i, fd;
+
+	for (i=0; i<64; i++) {
+		snprintf(path, sizeof(path), "/dev/hidraw%d", i);
+		fd = open(path, O_RDONLY);
+		if (fd < 0) continue;
+		if (is_debug_interface(fd)) {
+			fprintf(stderr, "Listening on %s\n", path);
+			return fd;
+		}
+		close(fd);
+	}
+	return -1;
+}
+
+static void print_event(const unsigned char *e)
+{
+	static int last_frame = -1;
+	unsigned row = EVENT_ROW(e), col = EVENT_COL(e), frame = EVENT_FRAME(e);
+	const char *name = row < NUM_ROWS ? key_names[row][col] : "?";
+
+	printf("%s %s row:%02X col:%02X frame:%u",
+		EVENT_TYPE(e) == EVENT_KEYDOWN ? "keydown" :
+		EVENT_TYPE(e) == EVENT_KEYUP ? "keyup  " : "event? ",
+		name, row, col, frame);
+	// frame numbers count milliseconds, and wrap every 2048
+	if (last_frame >= 0) printf(" +%ums", (frame - last_frame) & 0x7FF);
+	printf("\n");
+	last_frame = frame;
+}
+
+static void decode(const unsigned char *buf, int len)
+{
+	static unsigned char event[EVENT_BYTES];
+	static int have = 0;
+	int i;
+
+	for (i=0; i<len; i++) {
+		if (EVENT_IS_HEADER(buf[i])) {
+			event[0] = buf[i];
+			have = 1;
+		} else if (have && (buf[i] & 0x80)) {
+			event[have++] = buf[i];
+			if (have == EVENT_BYTES) {
+				print_event(event);
+				have = 0;
+			}
+		} else if (buf[i] != 0 && buf[i] != '\r') {
+			have = 0;
+			putchar(buf[i]);
+		}
+	}
+	fflush(stdout);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned char buf[64];
+	int fd, n;
+
+	if (argc > 2) {
+		fprintf(stderr, "usage: %s [hidraw device or file]\n", argv[0]);
+		return 2;
+	}
+	while (1) {
+		if (argc == 2) {
+			fd = strcmp(argv[1], "-") == 0 ? 0 : open(argv[1], O_RDONLY);
+			if (fd < 0) {
+				perror(argv[1]);
+				return 1;
+			}
+		} else {
+			fprintf(stderr, "Waiting for device...\n");
+			while ((fd = find_device()) < 0) sleep(1);
+		}
+		while ((n = read(fd, buf, sizeof(buf))) > 0) {
+			decode(buf, n);
+		}
+		if (argc == 2) return n < 0;
+		fprintf(stderr, "Device disconnected\n");
+		close(fd);
+	}
+}
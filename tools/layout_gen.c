@@ -0,0 +1,371 @@
+/* Layout compiler for the 286keyboard firmware.
+ * Copyright (c) 2013 W. Owen Parry
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* Reads the matrix description (layout.txt) and writes the header the
+ * firmware, the simulator and the tools build their tables from:
+ *
+ *   layout_gen <layout.txt> <layout_matrix.h>
+ *
+ * Nothing is written if the description is wrong.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#define MAX_COLUMNS 8		// a byte of columns per row
+#define MAX_ROWS 15		// matrix.c keeps a count of rows in 4 bits
+#define MAX_NAME 32
+
+struct pin {
+	char port;		// 'A' to 'F'
+	int bit;
+};
+
+static struct pin columns[MAX_COLUMNS], rows[MAX_ROWS];
+static int num_columns = 0, num_rows = 0;
+static char keys[MAX_ROWS][MAX_COLUMNS][MAX_NAME];
+static int key_rows = 0;
+
+// the distinct key names, in order of first use, and where each starts in
+// the pool
+static const char *names[MAX_ROWS * MAX_COLUMNS];
+static int name_at[MAX_ROWS * MAX_COLUMNS];
+static int num_names = 0;
+
+static const char *path;
+static int line = 0;
+
+static void error(const char *what, const char *arg)
+{
+	fprintf(stderr, "%s:%d: %s%s%s\n", path, line, what, arg ? ": " : "", arg ? arg : "");
+	exit(1);
+}
+
+static void parse_pin(const char *arg, struct pin *p)
+{
+	int i;
+
+	if (strlen(arg) != 2 || arg[0] < 'A' || arg[0] > 'F' || arg[1] < '0' || arg[1] > '7') {
+		error("bad pin, want A0 to F7", arg);
+	}
+	p->port = arg[0];
+	p->bit = arg[1] - '0';
+	for (i=0; i<num_columns; i++) {
+		if (&columns[i] != p && columns[i].port == p->port && columns[i].bit == p->bit) break;
+	}
+	if (i < num_columns) error("pin used twice", arg);
+	for (i=0; i<num_rows; i++) {
+		if (&rows[i] != p && rows[i].port == p->port && rows[i].bit == p->bit) break;
+	}
+	if (i < num_rows) error("pin used twice", arg);
+}
+
+static void parse_name(const char *arg, char *name)
+{
+	const char *s;
+
+	if (strlen(arg) >= MAX_NAME) error("name too long", arg);
+	for (s=arg; *s; s++) {
+		if (!isupper((unsigned char)*s) && !isdigit((unsigned char)*s) && *s != '_') {
+			error("bad key name", arg);
+		}
+	}
+	strcpy(name, arg);
+}
+
+static void read_layout(FILE *f)
+{
+	char buf[512], *arg;
+	int in_keys = 0, n;
+
+	while (fgets(buf, sizeof(buf), f)) {
+		line++;
+		if ((arg = strchr(buf, '#'))) *arg = 0;
+		if (!(arg = strtok(buf, " \t\r\n"))) continue;
+		if (in_keys) {
+			if (key_rows == num_rows) error("more rows of keys than rows", NULL);
+			for (n=0; arg; n++, arg = strtok(NULL, " \t\r\n")) {
+				if (n == num_columns) error("more keys than columns", arg);
+				parse_name(arg, keys[key_rows][n]);
+			}
+			if (n < num_columns) error("fewer keys than columns", NULL);
+			key_rows++;
+		} else if (strcmp(arg, "columns") == 0) {
+			while ((arg = strtok(NULL, " \t\r\n"))) {
+				if (num_columns == MAX_COLUMNS) error("too many columns", arg);
+				parse_pin(arg, &columns[num_columns++]);
+			}
+		} else if (strcmp(arg, "rows") == 0) {
+			while ((arg = strtok(NULL, " \t\r\n"))) {
+				if (num_rows == MAX_ROWS) error("too many rows", arg);
+				parse_pin(arg, &rows[num_rows++]);
+			}
+		} else if (strcmp(arg, "keys") == 0) {
+			if (!num_columns || !num_rows) error("keys before columns and rows", NULL);
+			in_keys = 1;
+		} else {
+			error("unknown section", arg);
+		}
+	}
+	if (!key_rows) error("no keys", NULL);
+	if (key_rows < num_rows) error("fewer rows of keys than rows", NULL);
+}
+
+// the ports of the pins given, each once, in order of first use
+static int ports_of(const struct pin *pins, int n, char *ports)
+{
+	int i, num = 0;
+
+	for (i=0; i<n; i++) {
+		if (!memchr(ports, pins[i].port, num)) ports[num++] = pins[i].port;
+	}
+	return num;
+}
+
+static unsigned pins_on(const struct pin *pins, int n, char port)
+{
+	unsigned mask = 0;
+	int i;
+
+	for (i=0; i<n; i++) {
+		if (pins[i].port == port) mask |= 1 << pins[i].bit;
+	}
+	return mask;
+}
+
+static void write_ports(FILE *f, const char *what, const struct pin *pins, int n)
+{
+	char ports[6];
+	int i, num = ports_of(pins, n, ports);
+
+	fprintf(f, "#define %s_PORTS(oP)", what);
+	for (i=0; i<num; i++) fprintf(f, " oP(%c)", ports[i]);
+	fprintf(f, "\n");
+	for (i=0; i<num; i++) {
+		fprintf(f, "#define %s_PINS_%c 0x%02X\n", what, ports[i], pins_on(pins, n, ports[i]));
+	}
+}
+
+// Columns sharing a port and the distance from pin to column are read
+// together, by a mask and a shift.
+static void write_read_columns(FILE *f)
+{
+	int done[MAX_COLUMNS] = { 0 };
+	int i, j, shift;
+	unsigned mask;
+	const char *sep = "";
+
+	fprintf(f, "#define READ_COLUMNS(pin) ((uint8_t)(");
+	for (i=0; i<num_columns; i++) {
+		if (done[i]) continue;
+		shift = i - columns[i].bit;
+		mask = 0;
+		for (j=i; j<num_columns; j++) {
+			if (columns[j].port == columns[i].port && j - columns[j].bit == shift) {
+				mask |= 1 << columns[j].bit;
+				done[j] = 1;
+			}
+		}
+		fprintf(f, "%s(pin(%c) & 0x%02X)", sep, columns[i].port, mask);
+		if (shift > 0) fprintf(f, " << %d", shift);
+		if (shift < 0) fprintf(f, " >> %d", -shift);
+		sep = " | ";
+	}
+	fprintf(f, "))\n");
+}
+
+static void write_pins(FILE *f, const char *what, const struct pin *pins, int n)
+{
+	int i;
+
+	fprintf(f, "#define %s_PORT {", what);
+	for (i=0; i<n; i++) fprintf(f, "%s'%c'", i ? ", " : " ", pins[i].port);
+	fprintf(f, " }\n#define %s_PIN {", what);
+	for (i=0; i<n; i++) fprintf(f, "%s%d", i ? ", " : " ", pins[i].bit);
+	fprintf(f, " }\n");
+}
+
+static int name_number(const char *name)
+{
+	int i;
+
+	for (i=0; i<num_names && strcmp(names[i], name) != 0; i++) ;
+	return i;
+}
+
+static int longer(const void *a, const void *b)
+{
+	int la = strlen(names[*(const int *)a]), lb = strlen(names[*(const int *)b]);
+
+	return la != lb ? lb - la : *(const int *)a - *(const int *)b;
+}
+
+// Each name once, NUL-ended; a name that ends a longer one is left out and
+// starts within it instead.
+static void write_names(FILE *f)
+{
+	int order[MAX_ROWS * MAX_COLUMNS];
+	int i, j, r, c, size = 0, len, tail;
+	const char *sep = "";
+
+	for (r=0; r<num_rows; r++) {
+		for (c=0; c<num_columns; c++) {
+			if (name_number(keys[r][c]) == num_names) names[num_names++] = keys[r][c];
+		}
+	}
+	for (i=0; i<num_names; i++) order[i] = i;
+	qsort(order, num_names, sizeof(order[0]), longer);
+	fprintf(f, "#define KEY_NAME_POOL");
+	for (i=0; i<num_names; i++) {
+		len = strlen(names[order[i]]);
+		for (j=0; j<i; j++) {
+			tail = strlen(names[order[j]]) - len;
+			if (strcmp(names[order[j]] + tail, names[order[i]]) == 0) break;
+		}
+		if (j < i) {
+			name_at[order[i]] = name_at[order[j]] + tail;
+			continue;
+		}
+		name_at[order[i]] = size;
+		size += len + 1;
+		fprintf(f, "%s \\\n\t\"%s\"", sep, names[order[i]]);
+		sep = " \"\\0\"";
+	}
+	fprintf(f, "\n#define KEY_NAME_POOL_SIZE %d\n", size);
+	fprintf(f, "#define NUM_KEY_NAMES %d\n", num_names);
+	fprintf(f, "// Each name, as oP(name, start in the pool), in order of first use.\n");
+	fprintf(f, "#define KEY_NAMES(oP)");
+	for (i=0; i<num_names; i++) {
+		fprintf(f, "%soP(%s, %d)", i % 6 ? " " : " \\\n\t", names[i], name_at[i]);
+	}
+	fprintf(f, "\n// The number in KEY_NAMES() of each switch's name, by row and column.\n");
+	fprintf(f, "#define KEY_NAME_INDEX { \\\n");
+	for (r=0; r<num_rows; r++) {
+		fprintf(f, "\t{");
+		for (c=0; c<num_columns; c++) fprintf(f, "%s%d", c ? ", " : " ", name_number(keys[r][c]));
+		fprintf(f, " }, \\\n");
+	}
+	fprintf(f, "}\n");
+}
+
+// the columns where rows a and b both have a switch
+static int shared_switches(int a, int b)
+{
+	int c, n = 0;
+
+	for (c=0; c<num_columns; c++) {
+		if (strcmp(keys[a][c], "NONE") != 0 && strcmp(keys[b][c], "NONE") != 0) n++;
+	}
+	return n;
+}
+
+static void write_layout(FILE *f)
+{
+	char ports[6];
+	int i, r, c, num;
+	unsigned mask;
+
+	fprintf(f, "/* Made from layout.txt by tools/layout_gen.c; edit that instead. */\n\n");
+	fprintf(f, "#ifndef layout_matrix_h__\n#define layout_matrix_h__\n\n");
+	fprintf(f, "#define NUM_ROWS %d\n#define NUM_COLUMNS %d\n\n", num_rows, num_columns);
+
+	fprintf(f, "// The ports driving rows, the row pins on each, and the pin of each row\n");
+	fprintf(f, "// on it in scan order (0 for a row on another port).\n");
+	write_ports(f, "ROW", rows, num_rows);
+	num = ports_of(rows, num_rows, ports);
+	for (i=0; i<num; i++) {
+		fprintf(f, "#define ROW_BITS_%c {", ports[i]);
+		for (r=0; r<num_rows; r++) {
+			fprintf(f, "%s0x%02X", r ? ", " : " ", rows[r].port == ports[i] ? 1 << rows[r].bit : 0);
+		}
+		fprintf(f, " }\n");
+	}
+
+	fprintf(f, "\n// The ports read for columns, and the column pins on each.\n");
+	write_ports(f, "COLUMN", columns, num_columns);
+	fprintf(f, "// The columns, closed as 1, from pin(port), the inverted pins of each\n");
+	fprintf(f, "// port of COLUMN_PORTS().\n");
+	write_read_columns(f);
+
+	fprintf(f, "\n// The port and pin of each row and column, for the simulator.\n");
+	write_pins(f, "ROW", rows, num_rows);
+	write_pins(f, "COLUMN", columns, num_columns);
+
+	fprintf(f, "\n// The columns with a switch, per row.\n#define KEY_MASKS {");
+	for (r=0; r<num_rows; r++) {
+		mask = 0;
+		for (c=0; c<num_columns; c++) {
+			if (strcmp(keys[r][c], "NONE") != 0) mask |= 1 << c;
+		}
+		fprintf(f, "%s0x%02X", r ? ", " : " ", mask);
+	}
+	fprintf(f, " }\n");
+
+	fprintf(f, "\n// The ghost rectangles: for each row, a bit per other row that has\n");
+	fprintf(f, "// switches in two or more of the same columns, and so can close one.\n");
+	fprintf(f, "#define GHOST_PARTNERS {");
+	for (r=0; r<num_rows; r++) {
+		mask = 0;
+		for (i=0; i<num_rows; i++) {
+			if (i != r && shared_switches(r, i) >= 2) mask |= 1 << i;
+		}
+		fprintf(f, "%s0x%04X", r ? ", " : " ", mask);
+	}
+	fprintf(f, " }\n");
+
+	fprintf(f, "\n// The key of each switch, as oP(name) of KEY_name, by row and column.\n");
+	fprintf(f, "#define KEYS(oP) \\\n");
+	for (r=0; r<num_rows; r++) {
+		fprintf(f, "\t{");
+		for (c=0; c<num_columns; c++) fprintf(f, "%soP(%s)", c ? ", " : "", keys[r][c]);
+		fprintf(f, "}%s\n", r < num_rows - 1 ? ", \\" : "");
+	}
+
+	fprintf(f, "\n// The key names, packed.\n");
+	write_names(f);
+	fprintf(f, "\n#endif\n");
+}
+
+int main(int argc, char **argv)
+{
+	FILE *f;
+
+	if (argc != 3) {
+		fprintf(stderr, "usage: %s <layout.txt> <layout_matrix.h>\n", argv[0]);
+		return 2;
+	}
+	path = argv[1];
+	if (!(f = fopen(path, "r"))) {
+		perror(path);
+		return 1;
+	}
+	read_layout(f);
+	fclose(f);
+	if (!(f = fopen(argv[2], "w"))) {
+		perror(argv[2]);
+		return 1;
+	}
+	write_layout(f);
+	return fclose(f) != 0;
+}
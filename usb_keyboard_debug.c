@@ -24,6 +24,7 @@
 // Version 1.0: Initial Release
 // Version 1.1: Add support for Teensy 2.0
 
+#include <stddef.h>
 #define USB_SERIAL_PRIVATE_INCLUDE
 #include "usb_keyboard_debug.h"
 
@@ -68,16 +69,30 @@
 #define KEYBOARD_SIZE		8
 #define KEYBOARD_BUFFER		EP_DOUBLE_BUFFER
 
-#define DEBUG_INTERFACE		1
+// Reports every key as a bit, for hosts using the report protocol.  The
+// boot interface above stays for BIOSes, which select the boot protocol.
+#define NKRO_INTERFACE		1
+#define NKRO_ENDPOINT		1
+#define NKRO_SIZE		(1 + KEYBOARD_KEYS_SIZE)
+#define NKRO_BUFFER		EP_DOUBLE_BUFFER
+
+// Built only above DEBUG_OFF (see usb_keyboard_debug.h)
+#ifdef USB_DEBUG_HID
+#define DEBUG_INTERFACE		2
 #define DEBUG_TX_ENDPOINT	4
 #define DEBUG_TX_SIZE		32
 #define DEBUG_TX_BUFFER		EP_DOUBLE_BUFFER
+#endif
 
 static const uint8_t PROGMEM endpoint_config_table[] = {
-	0,
+	1, EP_TYPE_INTERRUPT_IN,  EP_SIZE(NKRO_SIZE) | NKRO_BUFFER,
 	0,
 	1, EP_TYPE_INTERRUPT_IN,  EP_SIZE(KEYBOARD_SIZE) | KEYBOARD_BUFFER,
+#ifdef USB_DEBUG_HID
 	1, EP_TYPE_INTERRUPT_IN,  EP_SIZE(DEBUG_TX_SIZE) | DEBUG_TX_BUFFER
+#else
+	0
+#endif
 };
 
 
@@ -147,6 +162,41 @@ static uint8_t PROGMEM keyboard_hid_report_desc[] = {
         0xc0                 // End Collection
 };
 
+// Modifiers as in the boot report, then one bit for each usage 0 to
+// KEYBOARD_MAX_USAGE.
+static uint8_t PROGMEM nkro_hid_report_desc[] = {
+        0x05, 0x01,          // Usage Page (Generic Desktop),
+        0x09, 0x06,          // Usage (Keyboard),
+        0xA1, 0x01,          // Collection (Application),
+        0x75, 0x01,          //   Report Size (1),
+        0x95, 0x08,          //   Report Count (8),
+        0x05, 0x07,          //   Usage Page (Key Codes),
+        0x19, 0xE0,          //   Usage Minimum (224),
+        0x29, 0xE7,          //   Usage Maximum (231),
+        0x15, 0x00,          //   Logical Minimum (0),
+        0x25, 0x01,          //   Logical Maximum (1),
+        0x81, 0x02,          //   Input (Data, Variable, Absolute), ;Modifier byte
+        0x95, 0x05,          //   Report Count (5),
+        0x75, 0x01,          //   Report Size (1),
+        0x05, 0x08,          //   Usage Page (LEDs),
+        0x19, 0x01,          //   Usage Minimum (1),
+        0x29, 0x05,          //   Usage Maximum (5),
+        0x91, 0x02,          //   Output (Data, Variable, Absolute), ;LED report
+        0x95, 0x01,          //   Report Count (1),
+        0x75, 0x03,          //   Report Size (3),
+        0x91, 0x03,          //   Output (Constant),                 ;LED report padding
+        0x95, KEYBOARD_KEYS_SIZE * 8, //   Report Count (120),
+        0x75, 0x01,          //   Report Size (1),
+        0x15, 0x00,          //   Logical Minimum (0),
+        0x25, 0x01,          //   Logical Maximum (1),
+        0x05, 0x07,          //   Usage Page (Key Codes),
+        0x19, 0x00,          //   Usage Minimum (0),
+        0x29, KEYBOARD_MAX_USAGE, //   Usage Maximum (119),
+        0x81, 0x02,          //   Input (Data, Variable, Absolute), ;Key bitmap
+        0xc0                 // End Collection
+};
+
+#ifdef USB_DEBUG_HID
 static uint8_t PROGMEM debug_hid_report_desc[] = {
 	0x06, 0x31, 0xFF,			// Usage Page 0xFF31 (vendor defined)
 	0x09, 0x74,				// Usage 0x74
@@ -159,17 +209,25 @@ static uint8_t PROGMEM debug_hid_report_desc[] = {
 	0x81, 0x02,				// Input (array)
 	0xC0					// end collection
 };
+#endif
 
+#ifdef USB_DEBUG_HID
+#define NUM_INTERFACES           3
+#define CONFIG1_DESC_SIZE        (9+9+9+7+9+9+7+9+9+7)
+#else
+#define NUM_INTERFACES           2
 #define CONFIG1_DESC_SIZE        (9+9+9+7+9+9+7)
+#endif
 #define KEYBOARD_HID_DESC_OFFSET (9+9)
-#define DEBUG_HID_DESC_OFFSET    (9+9+9+7+9)
+#define NKRO_HID_DESC_OFFSET     (9+9+9+7+9)
+#define DEBUG_HID_DESC_OFFSET    (9+9+9+7+9+9+7+9)
 static uint8_t PROGMEM config1_descriptor[CONFIG1_DESC_SIZE] = {
 	// configuration descriptor, USB spec 9.6.3, page 264-266, Table 9-10
 	9, 					// bLength;
 	2,					// bDescriptorType;
 	LSB(CONFIG1_DESC_SIZE),			// wTotalLength
 	MSB(CONFIG1_DESC_SIZE),
-	2,					// bNumInterfaces
+	NUM_INTERFACES,				// bNumInterfaces
 	1,					// bConfigurationValue
 	0,					// iConfiguration
 	0xC0,					// bmAttributes
@@ -200,6 +258,33 @@ static uint8_t PROGMEM config1_descriptor[CONFIG1_DESC_SIZE] = {
 	0x03,					// bmAttributes (0x03=intr)
 	KEYBOARD_SIZE, 0,			// wMaxPacketSize
 	1,					// bInterval
+	// interface descriptor, USB spec 9.6.5, page 267-269, Table 9-12
+	9,					// bLength
+	4,					// bDescriptorType
+	NKRO_INTERFACE,				// bInterfaceNumber
+	0,					// bAlternateSetting
+	1,					// bNumEndpoints
+	0x03,					// bInterfaceClass (0x03 = HID)
+	0x00,					// bInterfaceSubClass
+	0x00,					// bInterfaceProtocol
+	0,					// iInterface
+	// HID interface descriptor, HID 1.11 spec, section 6.2.1
+	9,					// bLength
+	0x21,					// bDescriptorType
+	0x11, 0x01,				// bcdHID
+	0,					// bCountryCode
+	1,					// bNumDescriptors
+	0x22,					// bDescriptorType
+	sizeof(nkro_hid_report_desc),		// wDescriptorLength
+	0,
+	// endpoint descriptor, USB spec 9.6.6, page 269-271, Table 9-13
+	7,					// bLength
+	5,					// bDescriptorType
+	NKRO_ENDPOINT | 0x80,			// bEndpointAddress
+	0x03,					// bmAttributes (0x03=intr)
+	NKRO_SIZE, 0,				// wMaxPacketSize
+	1,					// bInterval
+#ifdef USB_DEBUG_HID
 	// interface descriptor, USB spec 9.6.5, page 267-269, Table 9-12
 	9,					// bLength
 	4,					// bDescriptorType
@@ -226,15 +311,17 @@ static uint8_t PROGMEM config1_descriptor[CONFIG1_DESC_SIZE] = {
 	0x03,					// bmAttributes (0x03=intr)
 	DEBUG_TX_SIZE, 0,			// wMaxPacketSize
 	1					// bInterval
+#endif
 };
 
 // If you're desperate for a little extra code memory, these strings
 // can be completely removed if iManufacturer, iProduct, iSerialNumber
 // in the device desciptor are changed to zeros.
+// wchar_t is 16 bits on the AVR (and in the simulator, via -fshort-wchar).
 struct usb_string_descriptor_struct {
 	uint8_t bLength;
 	uint8_t bDescriptorType;
-	int16_t wString[];
+	wchar_t wString[];
 };
 static struct usb_string_descriptor_struct PROGMEM string0 = {
 	4,
@@ -264,8 +351,12 @@ static struct descriptor_list_struct {
 	{0x0200, 0x0000, config1_descriptor, sizeof(config1_descriptor)},
 	{0x2200, KEYBOARD_INTERFACE, keyboard_hid_report_desc, sizeof(keyboard_hid_report_desc)},
 	{0x2100, KEYBOARD_INTERFACE, config1_descriptor+KEYBOARD_HID_DESC_OFFSET, 9},
+	{0x2200, NKRO_INTERFACE, nkro_hid_report_desc, sizeof(nkro_hid_report_desc)},
+	{0x2100, NKRO_INTERFACE, config1_descriptor+NKRO_HID_DESC_OFFSET, 9},
+#ifdef USB_DEBUG_HID
 	{0x2200, DEBUG_INTERFACE, debug_hid_report_desc, sizeof(debug_hid_report_desc)},
 	{0x2100, DEBUG_INTERFACE, config1_descriptor+DEBUG_HID_DESC_OFFSET, 9},
+#endif
 	{0x0300, 0x0000, (const uint8_t *)&string0, 4},
 	{0x0301, 0x0409, (const uint8_t *)&string1, sizeof(STR_MANUFACTURER)},
 	{0x0302, 0x0409, (const uint8_t *)&string2, sizeof(STR_PRODUCT)}
@@ -282,21 +373,35 @@ static struct descriptor_list_struct {
 // zero when we are not configured, non-zero when enumerated
 static volatile uint8_t usb_configuration=0;
 
-// the time remaining before we transmit any partially full
-// packet, or send a zero length packet.
-static volatile uint8_t debug_flush_timer=0;
-
 // which modifier keys are currently pressed
 // 1=left ctrl,    2=left shift,   4=left alt,    8=left gui
 // 16=right ctrl, 32=right shift, 64=right alt, 128=right gui
 uint8_t keyboard_modifier_keys=0;
 
-// which keys are currently pressed, up to 6 keys may be down at once
-uint8_t keyboard_keys[6]={0,0,0,0,0,0};
-
-// protocol setting from the host.  We use exactly the same report
-// either way, so this variable only stores the setting since we
-// are required to be able to report which setting is in use.
+// which keys are currently pressed, one bit per usage
+uint8_t keyboard_keys[KEYBOARD_KEYS_SIZE];
+
+// reports waiting for the endpoint, oldest first
+struct keyboard_report {
+	uint8_t modifiers;
+	uint8_t keys[KEYBOARD_KEYS_SIZE];
+#if LATENCY_STATS
+	uint16_t stamp;		// keyboard_report_stamp when queued
+	uint8_t age;		// frames queued, stopping at 255
+#endif
+};
+static struct keyboard_report keyboard_queue[KEYBOARD_QUEUE_SIZE];
+static uint8_t keyboard_queue_head=0;
+volatile uint8_t keyboard_queue_depth=0;
+volatile uint8_t keyboard_queue_max=0;
+volatile uint16_t keyboard_queue_overflows=0;
+#if LATENCY_STATS
+uint16_t keyboard_report_stamp=0;
+#endif
+
+// protocol setting from the host.  With the boot protocol (0) keys go
+// to the boot interface, 6 at most; with the report protocol (1) they
+// go to the NKRO interface instead.
 static uint8_t keyboard_protocol=1;
 
 // the idle configuration, how often we send the report to the
@@ -345,119 +450,210 @@ int8_t usb_keyboard_press(uint8_t key, uint8_t modifier)
 	int8_t r;
 
 	keyboard_modifier_keys = modifier;
-	keyboard_keys[0] = key;
+	keyboard_keys[key >> 3] |= (1 << (key & 7));
 	r = usb_keyboard_send();
 	if (r) return r;
 	keyboard_modifier_keys = 0;
-	keyboard_keys[0] = 0;
+	keyboard_keys[key >> 3] &= ~(1 << (key & 7));
 	return usb_keyboard_send();
 }
 
-// send the contents of keyboard_keys and keyboard_modifier_keys
-int8_t usb_keyboard_send(void)
+// write a report to the selected endpoint's FIFO
+static void write_boot_report(uint8_t modifiers, const uint8_t *bitmap)
 {
-	uint8_t i, intr_state, timeout;
-
-	if (!usb_configuration) return -1;
-	intr_state = SREG;
-	cli();
-	UENUM = KEYBOARD_ENDPOINT;
-	timeout = UDFNUML + 50;
-	while (1) {
-		// are we ready to transmit?
-		if (UEINTX & (1<<RWAL)) break;
-		SREG = intr_state;
-		// has the USB gone offline?
-		if (!usb_configuration) return -1;
-		// have we waited too long?
-		if (UDFNUML == timeout) return -1;
-		// get ready to try checking again
-		intr_state = SREG;
-		cli();
-		UENUM = KEYBOARD_ENDPOINT;
+	uint8_t keys[6] = {0,0,0,0,0,0};
+	uint8_t i, n, bits, code;
+
+	// the first 6 keys down, or ErrorRollOver in each slot if more are
+	for (i=0, n=0; i<KEYBOARD_KEYS_SIZE; i++) {
+		for (bits = bitmap[i], code = i*8; bits; bits >>= 1, code++) {
+			if (!(bits & 1)) continue;
+			if (n == 6) {
+				for (n=0; n<6; n++) keys[n] = KEY_ERROR_ROLLOVER;
+				i = KEYBOARD_KEYS_SIZE;
+				break;
+			}
+			keys[n++] = code;
+		}
 	}
-	UEDATX = keyboard_modifier_keys;
+	UEDATX = modifiers;
 	UEDATX = 0;
 	for (i=0; i<6; i++) {
-		UEDATX = keyboard_keys[i];
+		UEDATX = keys[i];
 	}
-	UEINTX = 0x3A;
-	keyboard_idle_count = 0;
-	SREG = intr_state;
-	return 0;
 }
 
-// transmit a character.  0 returned on success, -1 on error
-int8_t usb_debug_putchar(uint8_t c)
+static void write_nkro_report(uint8_t modifiers, const uint8_t *bitmap)
+{
+	uint8_t i;
+
+	UEDATX = modifiers;
+	for (i=0; i<KEYBOARD_KEYS_SIZE; i++) {
+		UEDATX = bitmap[i];
+	}
+}
+
+static void write_report(uint8_t modifiers, const uint8_t *bitmap)
+{
+	if (keyboard_protocol) {
+		write_nkro_report(modifiers, bitmap);
+	} else {
+		write_boot_report(modifiers, bitmap);
+	}
+}
+
+#define REPORT_ENDPOINT() (keyboard_protocol ? NKRO_ENDPOINT : KEYBOARD_ENDPOINT)
+
+#if LATENCY_STATS
+// count another frame for each report waiting, as far as a byte goes, so
+// one kept waiting long is not taken for a new one
+static void age_queued(void)
+{
+	uint8_t i;
+	struct keyboard_report *r;
+
+	for (i=0; i<keyboard_queue_depth; i++) {
+		r = &keyboard_queue[(keyboard_queue_head + i) & (KEYBOARD_QUEUE_SIZE - 1)];
+		if (r->age < 255) r->age++;
+	}
+}
+#endif
+
+// Move queued reports into the endpoint while it has a free bank.  Called
+// with interrupts disabled.
+static void send_queued(void)
+{
+	struct keyboard_report *r;
+
+	while (keyboard_queue_depth) {
+		UENUM = REPORT_ENDPOINT();
+		if (!(UEINTX & (1<<RWAL))) return;
+		r = &keyboard_queue[keyboard_queue_head];
+		write_report(r->modifiers, r->keys);
+		UEINTX = 0x3A;
+#if LATENCY_STATS
+		if (r->stamp) usb_report_sent(r->stamp, r->age);
+#endif
+		keyboard_idle_count = 0;
+		keyboard_queue_head = (keyboard_queue_head + 1) & (KEYBOARD_QUEUE_SIZE - 1);
+		keyboard_queue_depth--;
+	}
+}
+
+// queue the contents of keyboard_keys and keyboard_modifier_keys; this
+// never waits, the start of frame interrupt sends what the endpoint
+// could not take at once
+int8_t usb_keyboard_send(void)
 {
-	static uint8_t previous_timeout=0;
-	uint8_t timeout, intr_state;
+	struct keyboard_report *r;
+	uint8_t i, intr_state, tail;
 
-	// if we're not online (enumerated and configured), error
 	if (!usb_configuration) return -1;
-	// interrupts are disabled so these functions can be
-	// used from the main program or interrupt context,
-	// even both in the same program!
 	intr_state = SREG;
 	cli();
-	UENUM = DEBUG_TX_ENDPOINT;
-	// if we gave up due to timeout before, don't wait again
-	if (previous_timeout) {
-		if (!(UEINTX & (1<<RWAL))) {
-			SREG = intr_state;
-			return -1;
+	if (keyboard_queue_depth == KEYBOARD_QUEUE_SIZE) {
+		// full: this state replaces the newest one still waiting
+		keyboard_queue_overflows++;
+		tail = keyboard_queue_head + KEYBOARD_QUEUE_SIZE - 1;
+	} else {
+		tail = keyboard_queue_head + keyboard_queue_depth++;
+		if (keyboard_queue_depth > keyboard_queue_max) {
+			keyboard_queue_max = keyboard_queue_depth;
 		}
-		previous_timeout = 0;
+#if LATENCY_STATS
+		keyboard_queue[tail & (KEYBOARD_QUEUE_SIZE - 1)].stamp = 0;
+#endif
 	}
-	// wait for the FIFO to be ready to accept data
-	timeout = UDFNUML + 4;
-	while (1) {
-		// are we ready to transmit?
-		if (UEINTX & (1<<RWAL)) break;
-		SREG = intr_state;
-		// have we waited too long?
-		if (UDFNUML == timeout) {
-			previous_timeout = 1;
-			return -1;
-		}
-		// has the USB gone offline?
-		if (!usb_configuration) return -1;
-		// get ready to try checking again
-		intr_state = SREG;
-		cli();
-		UENUM = DEBUG_TX_ENDPOINT;
+	r = &keyboard_queue[tail & (KEYBOARD_QUEUE_SIZE - 1)];
+#if LATENCY_STATS
+	// a merged report keeps the older stamp, of the change still unsent
+	if (!r->stamp) {
+		r->stamp = keyboard_report_stamp;
+		r->age = 0;
 	}
-	// actually write the byte into the FIFO
-	UEDATX = c;
-	// if this completed a packet, transmit it now!
-	if (!(UEINTX & (1<<RWAL))) {
-		UEINTX = 0x3A;
-		debug_flush_timer = 0;
-	} else {
-		debug_flush_timer = 2;
+	keyboard_report_stamp = 0;
+#endif
+	r->modifiers = keyboard_modifier_keys;
+	for (i=0; i<KEYBOARD_KEYS_SIZE; i++) {
+		r->keys[i] = keyboard_keys[i];
 	}
+	send_queued();
 	SREG = intr_state;
 	return 0;
 }
 
+#ifdef USB_DEBUG_HID
+// Debug output goes into a ring buffer, which the start of frame interrupt
+// empties into the debug endpoint, so printing never waits for the host.
+// Only whole messages are sent: a message ends with a newline, or with
+// usb_debug_flush_output(), and one that does not fit is dropped whole.
+// Print from the main program only, not from interrupts.
+static uint8_t debug_buffer[DEBUG_BUFFER_SIZE];
+static volatile uint8_t debug_head=0;	// next byte to send
+static volatile uint8_t debug_line=0;	// end of the last whole message
+static uint8_t debug_tail=0;		// end of the message being written
+static uint8_t debug_dropping=0;	// rest of this message is dropped
+volatile uint16_t debug_dropped=0;	// messages dropped
+
+#define DEBUG_INDEX(i) ((uint8_t)(i) & (DEBUG_BUFFER_SIZE - 1))
+
+// buffer a character.  0 returned on success, -1 if it was dropped
+int8_t usb_debug_putchar(uint8_t c)
+{
+	uint8_t next;
+
+	if (!usb_configuration || debug_dropping) {
+		if (c == '\n') debug_dropping = 0;
+		return -1;
+	}
+	next = DEBUG_INDEX(debug_tail + 1);
+	if (next == debug_head) {
+		// full: forget the partial message, and the rest of it
+		debug_tail = debug_line;
+		debug_dropped++;
+		if (c != '\n') debug_dropping = 1;
+		return -1;
+	}
+	debug_buffer[debug_tail] = c;
+	debug_tail = next;
+	if (c == '\n') debug_line = debug_tail;
+	return 0;
+}
+
 
-// immediately transmit any buffered output.
+// end a message without a newline, so it can be sent
 void usb_debug_flush_output(void)
 {
-	uint8_t intr_state;
+	debug_line = debug_tail;
+	debug_dropping = 0;
+}
 
-	intr_state = SREG;
-	cli();
-	if (debug_flush_timer) {
-		UENUM = DEBUG_TX_ENDPOINT;
+// Move whole messages into the debug endpoint while it has a free bank; a
+// part filled packet is padded and sent, as there is nothing more to add.
+static void send_debug(void)
+{
+	uint8_t head = debug_head, partial = 0;
+
+	if (head == debug_line) return;
+	UENUM = DEBUG_TX_ENDPOINT;
+	while (head != debug_line && (UEINTX & (1<<RWAL))) {
+		UEDATX = debug_buffer[head];
+		head = DEBUG_INDEX(head + 1);
+		partial = 1;
+		if (!(UEINTX & (1<<RWAL))) {
+			UEINTX = 0x3A;
+			partial = 0;
+		}
+	}
+	if (partial) {
 		while ((UEINTX & (1<<RWAL))) {
 			UEDATX = 0;
 		}
 		UEINTX = 0x3A;
-		debug_flush_timer = 0;
 	}
-	SREG = intr_state;
+	debug_head = head;
 }
+#endif
 
 
 
@@ -474,7 +670,7 @@ void usb_debug_flush_output(void)
 //
 ISR(USB_GEN_vect)
 {
-	uint8_t intbits, t, i;
+	uint8_t intbits;
 	static uint8_t div4=0;
 
         intbits = UDINT;
@@ -486,34 +682,32 @@ ISR(USB_GEN_vect)
 		UECFG1X = EP_SIZE(ENDPOINT0_SIZE) | EP_SINGLE_BUFFER;
 		UEIENX = (1<<RXSTPE);
 		usb_configuration = 0;
+		keyboard_protocol = 1;	// HID: the report protocol after a reset
+		keyboard_queue_depth = 0;
+#ifdef USB_DEBUG_HID
+		debug_head = debug_line = debug_tail = 0;
+#endif
         }
 	if ((intbits & (1<<SOFI)) && usb_configuration) {
-		t = debug_flush_timer;
-		if (t) {
-			debug_flush_timer = -- t;
-			if (!t) {
-				UENUM = DEBUG_TX_ENDPOINT;
-				while ((UEINTX & (1<<RWAL))) {
-					UEDATX = 0;
-				}
-				UEINTX = 0x3A;
-			}
-		}
+		usb_start_of_frame();
+#if LATENCY_STATS
+		age_queued();
+#endif
+		send_queued();
 		if (keyboard_idle_config && (++div4 & 3) == 0) {
-			UENUM = KEYBOARD_ENDPOINT;
-			if (UEINTX & (1<<RWAL)) {
+			UENUM = REPORT_ENDPOINT();
+			if (!keyboard_queue_depth && (UEINTX & (1<<RWAL))) {
 				keyboard_idle_count++;
 				if (keyboard_idle_count == keyboard_idle_config) {
 					keyboard_idle_count = 0;
-					UEDATX = keyboard_modifier_keys;
-					UEDATX = 0;
-					for (i=0; i<6; i++) {
-						UEDATX = keyboard_keys[i];
-					}
+					write_report(keyboard_modifier_keys, keyboard_keys);
 					UEINTX = 0x3A;
 				}
 			}
 		}
+#ifdef USB_DEBUG_HID
+		send_debug();
+#endif
 	}
 }
 
@@ -620,6 +814,7 @@ ISR(USB_COM_vect)
 		}
 		if (bRequest == SET_CONFIGURATION && bmRequestType == 0) {
 			usb_configuration = wValue;
+			keyboard_protocol = 1;
 			usb_send_in();
 			cfg = endpoint_config_table;
 			for (i=1; i<5; i++) {
@@ -675,14 +870,14 @@ ISR(USB_COM_vect)
 			}
 		}
 		#endif
-		if (wIndex == KEYBOARD_INTERFACE) {
+		if (wIndex == KEYBOARD_INTERFACE || wIndex == NKRO_INTERFACE) {
 			if (bmRequestType == 0xA1) {
 				if (bRequest == HID_GET_REPORT) {
 					usb_wait_in_ready();
-					UEDATX = keyboard_modifier_keys;
-					UEDATX = 0;
-					for (i=0; i<6; i++) {
-						UEDATX = keyboard_keys[i];
+					if (wIndex == NKRO_INTERFACE) {
+						write_nkro_report(keyboard_modifier_keys, keyboard_keys);
+					} else {
+						write_boot_report(keyboard_modifier_keys, keyboard_keys);
 					}
 					usb_send_in();
 					return;
@@ -693,7 +888,7 @@ ISR(USB_COM_vect)
 					usb_send_in();
 					return;
 				}
-				if (bRequest == HID_GET_PROTOCOL) {
+				if (bRequest == HID_GET_PROTOCOL && wIndex == KEYBOARD_INTERFACE) {
 					usb_wait_in_ready();
 					UEDATX = keyboard_protocol;
 					usb_send_in();
@@ -715,7 +910,7 @@ ISR(USB_COM_vect)
 					usb_send_in();
 					return;
 				}
-				if (bRequest == HID_SET_PROTOCOL) {
+				if (bRequest == HID_SET_PROTOCOL && wIndex == KEYBOARD_INTERFACE) {
 					keyboard_protocol = wValue;
 					//usb_wait_in_ready();
 					usb_send_in();
@@ -723,6 +918,7 @@ ISR(USB_COM_vect)
 				}
 			}
 		}
+#ifdef USB_DEBUG_HID
 		if (wIndex == DEBUG_INTERFACE) {
 			if (bRequest == HID_GET_REPORT && bmRequestType == 0xA1) {
 				len = wLength;
@@ -743,6 +939,7 @@ ISR(USB_COM_vect)
 				return;
 			}
 		}
+#endif
 	}
 	UECONX = (1<<STALLRQ) | (1<<EPEN);	// stall
 }
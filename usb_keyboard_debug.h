@@ -9,12 +9,60 @@ uint8_t usb_configured(void);		// is the USB port configured
 int8_t usb_keyboard_press(uint8_t key, uint8_t modifier);
 int8_t usb_keyboard_send(void);
 extern uint8_t keyboard_modifier_keys;
-extern uint8_t keyboard_keys[6];
+// one bit per key usage (bit n&7 of byte n>>3), so any number can be down
+#define KEYBOARD_KEYS_SIZE	15
+#define KEYBOARD_MAX_USAGE	(KEYBOARD_KEYS_SIZE * 8 - 1)
+extern uint8_t keyboard_keys[KEYBOARD_KEYS_SIZE];
+// usb_keyboard_send() queues reports rather than waiting for the host,
+// and merges a report into the newest one waiting when the queue is full
+#ifndef KEYBOARD_QUEUE_SIZE
+#define KEYBOARD_QUEUE_SIZE	8	// a power of 2
+#endif
+extern volatile uint8_t keyboard_queue_depth;	// reports waiting now
+extern volatile uint8_t keyboard_queue_max;	// most ever waiting
+extern volatile uint16_t keyboard_queue_overflows;	// reports merged when full
 extern volatile uint8_t keyboard_leds;
 
-int8_t usb_debug_putchar(uint8_t c);	// transmit a character
-void usb_debug_flush_output(void);	// immediately transmit any buffered output
+void usb_start_of_frame(void);		// supplied by the application, called
+					// from the start-of-frame interrupt
+
+// How much goes out on the debug channel, set by DEBUG_LEVEL in the
+// Makefile.  Each level adds to the one before; at DEBUG_OFF there is no
+// debug interface at all.
+#define DEBUG_OFF	0
+#define DEBUG_ERRORS	1	// faults, and what SysReq commands print
+#define DEBUG_EVENTS	2	// every key change
+#define DEBUG_VERBOSE	3	// startup and mode changes
+#ifndef DEBUG_LEVEL
+#define DEBUG_LEVEL	DEBUG_VERBOSE
+#endif
+
+// Keypress to report latency is measured only where it can be shown
+#if DEBUG_LEVEL == DEBUG_OFF
+#undef LATENCY_STATS
+#endif
+#ifndef LATENCY_STATS
+#define LATENCY_STATS	0
+#endif
+
+#if DEBUG_LEVEL > DEBUG_OFF
 #define USB_DEBUG_HID
+int8_t usb_debug_putchar(uint8_t c);	// buffer a character for sending
+void usb_debug_flush_output(void);	// end a message without a newline
+#ifndef DEBUG_BUFFER_SIZE
+#define DEBUG_BUFFER_SIZE	256	// a power of 2, at most 256
+#endif
+extern volatile uint16_t debug_dropped;	// messages lost to a full buffer
+#endif
+
+#if LATENCY_STATS
+// A nonzero keyboard_report_stamp is taken by the next report queued (and
+// cleared), and handed to usb_report_sent() from the interrupt that
+// commits that report, with the frames it spent in the queue
+extern uint16_t keyboard_report_stamp;
+void usb_report_sent(uint16_t stamp, uint8_t frames);	// supplied by the
+							// application
+#endif
 
 #define KEY_CTRL	0x01
 #define KEY_SHIFT	0x02
@@ -29,6 +77,8 @@ void usb_debug_flush_output(void);	// immediately transmit any buffered output
 #define KEY_RIGHT_ALT	0x40
 #define KEY_RIGHT_GUI	0x80
 
+#define KEY_ERROR_ROLLOVER	1
+
 #define KEY_A		4
 #define KEY_B		5
 #define KEY_C		6